@@ -0,0 +1,186 @@
+#include "aliasexporter.h"
+#include "fileutils.h"
+#include "settings.h"
+#include "option.h"
+#include <iostream>
+#include <sstream>
+#include <algorithm>
+#include <set>
+#include <map>
+#include <ctype.h>
+
+std::string AliasExporter::defaultAliasFile() {
+    return FileUtils::getHomeDir() + "/" + Settings::getConfigDir() + "/aliases";
+}
+
+std::string AliasExporter::defaultFlatFile() {
+    return FileUtils::getHomeDir() + "/" + Settings::getConfigDir() + "/contacts.tsv";
+}
+
+static std::string lower(const std::string& text) {
+    std::string result = text;
+    for(size_t i=0; i<result.size(); i++)
+        result[i] = tolower((unsigned char)result[i]);
+    return result;
+}
+
+static bool byKey(const std::pair<std::string, std::string>& a, const std::pair<std::string, std::string>& b) {
+    return a.first < b.first;
+}
+
+// one entry per address, compared case insensitive, sorted by address
+std::vector<AliasExporter::Entry> AliasExporter::entries(const std::vector<Person> &people) {
+    std::map<std::string, Entry> unique;
+    for(unsigned int i=0; i<people.size(); i++) {
+        const Person& p = people.at(i);
+        for(unsigned int j=0; j<p.Emails.size(); j++) {
+            std::string key = lower(p.Emails.at(j));
+            if(unique.count(key) > 0)
+                continue;
+
+            if(false == isPlainAddress(p.Emails.at(j))) {
+                if(Option::isVerbose())
+                    std::cout << "Not exporting the address '" << removeControls(p.Emails.at(j)) << "'" << std::endl;
+                continue;
+            }
+
+            Entry e;
+            e.email = p.Emails.at(j);
+            e.name = removeControls(p.FirstName);
+            if(e.name.size() > 0 && p.LastName.size() > 0)
+                e.name += " ";
+            e.name += removeControls(p.LastName);
+            unique[key] = e;
+        }
+    }
+
+    std::vector<Entry> result;
+    for(std::map<std::string, Entry>::const_iterator it = unique.begin(); it != unique.end(); ++it)
+        result.push_back(it->second);
+    return result;
+}
+
+// local@domain of the characters an address needs, nothing a shell or
+// mutt's rc parser would act on: no spaces, quotes, brackets, '`', '$' or '#'
+bool AliasExporter::isPlainAddress(const std::string &email) {
+    size_t at = email.find('@');
+    if(at == std::string::npos || at == 0 || at == email.size() - 1 || email.find('@', at + 1) != std::string::npos)
+        return false;
+
+    for(size_t i=0; i<email.size(); i++) {
+        unsigned char c = email[i];
+        if(false == (c < 0x80 && isalnum(c)) && std::string("@.+-_=%!&*/?^{|}~").find(c) == std::string::npos)
+            return false;
+    }
+    return true;
+}
+
+// control characters, newlines and tabs included, become spaces
+std::string AliasExporter::removeControls(const std::string &text) {
+    std::string result = text;
+    for(size_t i=0; i<result.size(); i++) {
+        if((unsigned char)result[i] < 0x20 || result[i] == 0x7f)
+            result[i] = ' ';
+    }
+    return result;
+}
+
+// i.e. 'john.doe', from the name or, without one, the local part of the address
+std::string AliasExporter::aliasKey(const Entry &entry) {
+    std::string source = entry.name.size() > 0 ? entry.name : entry.email.substr(0, entry.email.find('@'));
+    std::string key;
+    for(size_t i=0; i<source.size(); i++) {
+        unsigned char c = source[i];
+        if(isalnum(c) && c < 0x80) {
+            key += tolower(c);
+        } else if((c == ' ' || c == '.' || c == '-' || c == '_') && key.size() > 0 && key[key.size() - 1] != '.') {
+            key += '.';
+        }
+    }
+
+    while(key.size() > 0 && key[key.size() - 1] == '.')
+        key.erase(key.size() - 1);
+
+    return key.size() > 0 ? key : "contact";
+}
+
+// names with characters special to rfc 5322 addresses need quotes
+std::string AliasExporter::quoteName(const std::string &name) {
+    if(name.find_first_of(",;:<>@()[]\\\".") == std::string::npos)
+        return name;
+
+    std::string result = "\"";
+    for(size_t i=0; i<name.size(); i++) {
+        if(name[i] == '"' || name[i] == '\\')
+            result += '\\';
+        result += name[i];
+    }
+    return result + "\"";
+}
+
+// mutt runs `commands` and expands $VARIABLES in an alias line even inside
+// quotes, a backslash makes them plain characters. '#' would start a comment
+std::string AliasExporter::escapeRc(const std::string &text) {
+    std::string result;
+    for(size_t i=0; i<text.size(); i++) {
+        if(text[i] == '\\' || text[i] == '`' || text[i] == '$' || text[i] == '#')
+            result += '\\';
+        result += text[i];
+    }
+    return result;
+}
+
+bool AliasExporter::write(const std::string &file, const std::string &content, const std::string &what, size_t count) {
+    bool changed = false;
+    if(false == FileUtils::replaceFileContent(file, content, &changed))
+        return false;
+
+    if(changed)
+        std::cout << "Exported " << count << " " << what << " to '" << file << "'" << std::endl;
+    else
+        std::cout << "The " << what << " in '" << file << "' are up to date" << std::endl;
+
+    return true;
+}
+
+bool AliasExporter::exportAliases(const std::vector<Person> &people, const std::string &file) {
+    std::vector<Entry> all = entries(people);
+
+    // keys must be unique, the second john.doe becomes john.doe.2
+    std::vector< std::pair<std::string, std::string> > lines;
+    std::map<std::string, int> used;
+    for(unsigned int i=0; i<all.size(); i++) {
+        const Entry& e = all.at(i);
+        std::string key = aliasKey(e);
+        int n = ++used[key];
+        if(n > 1) {
+            std::stringstream ss;
+            ss << key << "." << n;
+            key = ss.str();
+        }
+
+        std::string line = "alias " + key + " ";
+        if(e.name.size() > 0)
+            line += escapeRc(quoteName(e.name)) + " ";
+        line += "<" + e.email + ">\n";
+        lines.push_back(std::make_pair(key, line));
+    }
+
+    std::stable_sort(lines.begin(), lines.end(), byKey);
+
+    std::string content = "# generated by muttvcardsearch, changes will be overwritten\n";
+    for(unsigned int i=0; i<lines.size(); i++)
+        content += lines.at(i).second;
+
+    return write(file, content, "aliases", lines.size());
+}
+
+bool AliasExporter::exportFlat(const std::vector<Person> &people, const std::string &file) {
+    std::vector<Entry> all = entries(people);
+
+    std::string content;
+    for(unsigned int i=0; i<all.size(); i++)
+        content += all.at(i).email + "\t" + all.at(i).name + "\n";
+
+    return write(file, content, "addresses", all.size());
+}
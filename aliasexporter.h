@@ -0,0 +1,39 @@
+#ifndef ALIASEXPORTER_H
+#define ALIASEXPORTER_H
+
+#include <string>
+#include <vector>
+#include "person.h"
+
+// Turns the cached addresses into files mutt can use without running us:
+// an alias file for 'source' and a tab separated file with the lines a
+// query_command returns. Both are sorted, list every address once and are
+// only rewritten when their content changes. The cards come from shared
+// address books, so addresses that are not a plain local@domain are left
+// out and names can't run commands or start new lines in mutt's rc parser.
+class AliasExporter
+{
+public:
+    static std::string defaultAliasFile();
+    static std::string defaultFlatFile();
+
+    static bool exportAliases(const std::vector<Person>& people, const std::string& file);
+    static bool exportFlat(const std::vector<Person>& people, const std::string& file);
+
+private:
+    struct Entry
+    {
+        std::string email;
+        std::string name;
+    };
+
+    static std::vector<Entry> entries(const std::vector<Person>& people);
+    static bool isPlainAddress(const std::string& email);
+    static std::string removeControls(const std::string& text);
+    static std::string aliasKey(const Entry& entry);
+    static std::string quoteName(const std::string& name);
+    static std::string escapeRc(const std::string& text);
+    static bool write(const std::string& file, const std::string& content, const std::string& what, size_t count);
+};
+
+#endif // ALIASEXPORTER_H
@@ -0,0 +1,273 @@
+// Microbenchmarks for the parsing and search hot paths.
+//
+// All input is either generated by CardGenerator with a fixed seed or read
+// from the recorded server responses in bench/fixtures, so the numbers of
+// two runs on the same machine are comparable.
+//
+// usage: muttvcardsearch_bench [filter]
+//   only benchmarks whose name contains filter are run
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <functional>
+#include <stdlib.h>
+#include <unistd.h>
+
+#include "vCard/vcard.h"
+#include "cardcurler.h"
+#include "parallelparser.h"
+#include "cache.h"
+#include "resultwriter.h"
+#include "fileutils.h"
+#include "stringutils.h"
+#include "cardgenerator.h"
+#include "searchtemplates.h"
+
+#ifndef BENCH_FIXTURE_DIR
+#define BENCH_FIXTURE_DIR "bench/fixtures"
+#endif
+
+// every benchmark runs at least this long
+#define MIN_RUNTIME_SECONDS 0.5
+
+static std::string filter;
+
+// keeps the optimizer from throwing away results
+static volatile size_t sink;
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs fn until MIN_RUNTIME_SECONDS passed and prints the time per call
+// and, if items > 0, the throughput in items per second
+static void bench(const std::string& name, long items, const std::function<void()>& fn) {
+    if(filter.size() > 0 && name.find(filter) == std::string::npos)
+        return;
+
+    fn(); // warm up
+
+    long iterations = 0;
+    double start = now();
+    double elapsed = 0;
+    while(elapsed < MIN_RUNTIME_SECONDS || iterations < 3) {
+        fn();
+        iterations++;
+        elapsed = now() - start;
+    }
+
+    double perCall = elapsed / iterations;
+    std::cout << std::left << std::setw(44) << name
+              << std::right << std::setw(14) << std::fixed << std::setprecision(2) << perCall * 1e6 << " us/op";
+    if(items > 0)
+        std::cout << std::setw(16) << std::setprecision(0) << items / perCall << " items/s";
+    std::cout << std::endl;
+}
+
+static std::string tempDir() {
+    char tmpl[] = "/tmp/muttvcardsearch-bench-XXXXXX";
+    char* dir = mkdtemp(tmpl);
+    if(dir == NULL) {
+        std::cerr << "Unable to create temporary directory" << std::endl;
+        exit(1);
+    }
+    return dir;
+}
+
+// builds a cache of count generated contacts in dir
+static std::string buildCache(const std::string& dir, int count) {
+    std::stringstream file;
+    file << dir << "/cache-" << count << ".sqlite3";
+
+    CardGenerator gen(count);
+    std::vector<Person> people = gen.people(count);
+
+    Cache cache(file.str());
+    cache.createDatabase();
+    cache.setStorageOptions(false, false);
+    cache.beginTransaction();
+    for(unsigned int i=0; i<people.size(); i++) {
+        const Person& p = people.at(i);
+        cache.addVCard(p.FirstName, p.LastName, p.Emails, p.rawCardData, p.lastUpdatedAt, p.section);
+    }
+    cache.commitTransaction();
+    cache.commitDatabase();
+    return file.str();
+}
+
+static void benchParsing() {
+    CardGenerator gen;
+    std::string small = gen.smallCard();
+    std::string large = gen.largeCard();
+    std::string photo = gen.photoCard();
+
+    bench("vCard::fromString small", 1, [&]() { sink += vCard::fromString(small).size(); });
+    bench("vCard::fromString large", 1, [&]() { sink += vCard::fromString(large).size(); });
+    bench("vCard::fromString photo", 1, [&]() { sink += vCard::fromString(photo).size(); });
+
+    std::string many;
+    for(int i=0; i<100; i++)
+        many += gen.largeCard();
+    bench("vCard::fromString 100 large in one string", 100, [&]() { sink += vCard::fromString(many).size(); });
+
+    // the same 2000 cards one chunk each, parsed by a single thread and by the pool
+    std::vector<std::string> chunks;
+    for(int i=0; i<2000; i++)
+        chunks.push_back(gen.largeCard());
+    bench("parse 2000 large, 1 thread", 2000, [&]() {
+        for(unsigned int i=0; i<chunks.size(); i++) {
+            std::vector<vCard> parsed = vCard::fromString(chunks[i]);
+            Person p;
+            CardCurler::createPerson(&parsed[0], &p);
+            sink += p.Emails.size();
+        }
+    });
+    std::stringstream pooled;
+    pooled << "ParallelParser::parse 2000 large, " << ParallelParser::workers(chunks.size()) << " threads";
+    bench(pooled.str(), 2000, [&]() { sink += ParallelParser::parse(chunks).size(); });
+
+    std::vector<vCard> cards = vCard::fromString(large);
+    bench("CardCurler::createPerson large", 1, [&]() {
+        Person p;
+        CardCurler::createPerson(&cards[0], &p);
+        sink += p.Emails.size();
+    });
+
+    DavDialect sogo;
+    CardGenerator::findDialect("sogo", &sogo);
+    std::string escaped = CardGenerator::escapeXml(sogo, large);
+    bench("CardCurler::fixHtml large", 1, [&]() {
+        std::string s = escaped;
+        CardCurler::fixHtml(&s);
+        sink += s.size();
+    });
+}
+
+static void benchStringUtils() {
+    CardGenerator gen;
+    DavDialect owncloud;
+    CardGenerator::findDialect("owncloud", &owncloud);
+
+    std::vector<std::string> cards;
+    for(int i=0; i<200; i++)
+        cards.push_back(gen.smallCard());
+    std::string response = gen.reportResponse(owncloud, "/remote.php/carddav/addressbooks/bench/contacts/", cards);
+
+    bench("StringUtils::split 200 card response", 200, [&]() {
+        sink += StringUtils::split(response, "<card:address-data>").size();
+    });
+
+    bench("StringUtils::replace &#13; 200 card response", 200, [&]() {
+        std::string s = response;
+        StringUtils::replace(&s, "&#13;", "");
+        sink += s.size();
+    });
+}
+
+static void benchFixtures() {
+    std::vector<DavDialect> dialects = CardGenerator::dialects();
+    for(unsigned int i=0; i<dialects.size(); i++) {
+        std::string name = dialects.at(i).name;
+        std::string report, propfind;
+
+        if(false == FileUtils::getFileContent(std::string(BENCH_FIXTURE_DIR) + "/" + name + "-report.xml", &report))
+            continue;
+        if(false == FileUtils::getFileContent(std::string(BENCH_FIXTURE_DIR) + "/" + name + "-propfind.xml", &propfind))
+            continue;
+
+        // make sure the fixture is still understood before timing it
+        std::vector<Person> people = CardCurler::parseAddressData(report);
+        if(people.size() == 0)
+            std::cerr << "WARN: no vcards found in fixture " << name << "-report.xml" << std::endl;
+        if(CardCurler::parseCTag(propfind).size() == 0)
+            std::cerr << "WARN: no ctag found in fixture " << name << "-propfind.xml" << std::endl;
+
+        bench("parseAddressData fixture " + name, people.size(), [&]() { sink += CardCurler::parseAddressData(report).size(); });
+        bench("parseHrefs fixture " + name, 0, [&]() { sink += CardCurler::parseHrefs(propfind).size(); });
+    }
+}
+
+static void benchCache() {
+    std::string dir = tempDir();
+
+    CardGenerator gen(7);
+    std::vector<Person> people = gen.people(1000);
+
+    int run = 0;
+    bench("Cache::addVCard bulk import 1k (1 tx)", 1000, [&]() {
+        std::stringstream file;
+        file << dir << "/import-" << run++ << ".sqlite3";
+        Cache cache(file.str());
+        cache.createDatabase();
+        cache.setStorageOptions(false, false);
+        cache.beginTransaction();
+        for(unsigned int i=0; i<people.size(); i++) {
+            const Person& p = people.at(i);
+            cache.addVCard(p.FirstName, p.LastName, p.Emails, p.rawCardData, p.lastUpdatedAt, p.section);
+        }
+        cache.commitTransaction();
+        cache.commitDatabase();
+        FileUtils::fileRemove(file.str());
+    });
+
+    int sizes[] = { 1000, 10000, 100000 };
+    for(int i=0; i<3; i++) {
+        std::stringstream name;
+        name << "Cache search " << sizes[i] / 1000 << "k";
+        if(filter.size() > 0 && (name.str() + " hit").find(filter) == std::string::npos
+                && (name.str() + " miss").find(filter) == std::string::npos
+                && (name.str() + " fuzzy").find(filter) == std::string::npos
+                && (name.str() + " complete").find(filter) == std::string::npos)
+            continue;
+
+        std::string file = buildCache(dir, sizes[i]);
+        bench(name.str() + " hit", 0, [&]() {
+            std::stringstream out;
+            Cache cache(file);
+            ResultWriter writer(out);
+            std::vector<std::string> sections;
+            sink += cache.writeFromCache("smith", sections, &writer) + cache.writeFromCache("jensen", sections, &writer);
+        });
+        bench(name.str() + " miss", 0, [&]() {
+            std::stringstream out;
+            Cache cache(file);
+            ResultWriter writer(out);
+            std::vector<std::string> sections;
+            sink += cache.writeFromCache("nobody-has-this-name", sections, &writer);
+        });
+        bench(name.str() + " fuzzy", 0, [&]() {
+            std::stringstream out;
+            Cache cache(file);
+            ResultWriter writer(out);
+            std::vector<std::string> sections;
+            sink += cache.writeFuzzyFromCache("jensne", sections, DEFAULT_SEARCH_LIMIT, &writer) + cache.writeFuzzyFromCache("nobdy", sections, DEFAULT_SEARCH_LIMIT, &writer);
+        });
+        bench(name.str() + " complete", 0, [&]() {
+            std::stringstream out;
+            Cache cache(file);
+            ResultWriter writer(out);
+            std::vector<std::string> sections;
+            sink += cache.writeCompletions("jo", sections, DEFAULT_COMPLETE_LIMIT, &writer);
+        });
+        FileUtils::fileRemove(file);
+    }
+
+    rmdir(dir.c_str());
+}
+
+int main(int argc, char *argv[])
+{
+    if(argc > 1)
+        filter = argv[1];
+
+    benchParsing();
+    benchStringUtils();
+    benchFixtures();
+    benchCache();
+
+    return 0;
+}
@@ -0,0 +1,269 @@
+#include "cardgenerator.h"
+#include <sstream>
+#include <algorithm>
+
+static const char* const FIRST_NAMES[] = {
+    "John", "Jane", "Peter", "Anna", "Jürgen", "Søren", "José", "Maria", "Ike", "Torsten",
+    "Benjamin", "Laura", "Mohammed", "Chen", "Olga", "François", "Emma", "Lukas", "Noah", "Mia"
+};
+
+static const char* const LAST_NAMES[] = {
+    "Doe", "Smith", "Müller", "Schmidt", "García", "Jensen", "Devolder", "Flammiger", "Frank", "Nguyen",
+    "Kowalski", "Rossi", "Dubois", "Novák", "Öztürk", "Andersson", "Brown", "Wilson", "Taylor", "Meyer"
+};
+
+static const char* const DOMAINS[] = {
+    "example.com", "example.org", "example.net", "mail.example.de", "corp.example.co.uk"
+};
+
+#define ARRAY_SIZE(a) (int)(sizeof(a) / sizeof(a[0]))
+
+CardGenerator::CardGenerator(unsigned int seed)
+{
+    state = seed;
+    serial = 0;
+}
+
+// plain LCG, good enough and identical on every platform
+unsigned int CardGenerator::next() {
+    state = state * 1103515245u + 12345u;
+    return (state >> 8) & 0xffffff;
+}
+
+std::string CardGenerator::pick(const char* const* list, int size) {
+    return list[next() % size];
+}
+
+static std::string mailify(const std::string& name) {
+    std::string result;
+    for(unsigned int i=0; i<name.size(); i++) {
+        unsigned char c = name[i];
+        if(c < 0x80)
+            result += (char)::tolower(c);
+    }
+    return result;
+}
+
+std::string CardGenerator::header(std::string *firstName, std::string *lastName, std::string *email) {
+    *firstName = pick(FIRST_NAMES, ARRAY_SIZE(FIRST_NAMES));
+    *lastName = pick(LAST_NAMES, ARRAY_SIZE(LAST_NAMES));
+
+    std::stringstream mail;
+    mail << mailify(*firstName) << "." << mailify(*lastName) << "." << serial << "@" << pick(DOMAINS, ARRAY_SIZE(DOMAINS));
+    *email = mail.str();
+
+    std::stringstream ss;
+    ss << "BEGIN:VCARD\r\n";
+    ss << "VERSION:3.0\r\n";
+    ss << "PRODID:-//muttvcardsearch//bench//EN\r\n";
+    ss << "UID:" << serial << "-" << next() << "\r\n";
+    ss << "N:" << *lastName << ";" << *firstName << ";;;\r\n";
+    ss << "FN:" << *firstName << " " << *lastName << "\r\n";
+    ss << "EMAIL;TYPE=INTERNET:" << *email << "\r\n";
+    serial++;
+    return ss.str();
+}
+
+std::string CardGenerator::smallCard() {
+    std::string fn, ln, email;
+    std::string card = header(&fn, &ln, &email);
+    card += "REV:2023-04-01T10:00:00Z\r\n";
+    card += "END:VCARD\r\n";
+    return card;
+}
+
+std::string CardGenerator::largeCard() {
+    std::string fn, ln, email;
+    std::stringstream ss;
+    ss << header(&fn, &ln, &email);
+    ss << "item1.EMAIL;TYPE=INTERNET:" << mailify(fn) << "@private.example.com\r\n";
+    ss << "EMAIL;TYPE=WORK:" << mailify(ln) << "." << serial << "@work.example.com\r\n";
+    ss << "ORG:Example Corporation;Research and Development\r\n";
+    ss << "TITLE:Senior Engineer\r\n";
+    // one call to next() per statement, the evaluation order of << operands is unspecified before C++17
+    for(int i=0; i<4; i++) {
+        unsigned int area = next() % 1000;
+        unsigned int number = next();
+        ss << "TEL;TYPE=" << (i % 2 ? "CELL" : "WORK") << ":+49 " << area << " " << number << "\r\n";
+    }
+    unsigned int street = next() % 200;
+    ss << "ADR;TYPE=WORK:;;Example Street " << street << ";Berlin;;10115;Germany\r\n";
+    street = next() % 200;
+    ss << "ADR;TYPE=HOME:;;Other Road " << street << ";Hamburg;;20095;Germany\r\n";
+    unsigned int year = 50 + next() % 50;
+    unsigned int month = 1 + next() % 9;
+    unsigned int day = next() % 9;
+    ss << "BDAY:19" << year << "-0" << month << "-1" << day << "\r\n";
+    ss << "CATEGORIES:Work,Friends,Newsletter\r\n";
+    ss << "URL:https://www.example.com/people/" << serial << "\r\n";
+
+    // a long note, folded like real servers do
+    std::string note = "NOTE:";
+    for(int i=0; i<12; i++)
+        note += "Met at the conference and talked about carddav synchronisation. ";
+    for(unsigned int pos=0; pos<note.size(); pos += 74) {
+        if(pos > 0) ss << " ";
+        ss << note.substr(pos, 74) << "\r\n";
+    }
+
+    ss << "REV:2023-04-01T10:00:00Z\r\n";
+    ss << "END:VCARD\r\n";
+    return ss.str();
+}
+
+std::string CardGenerator::photoCard(int photoBytes) {
+    static const char BASE64[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+
+    std::string fn, ln, email;
+    std::string card = header(&fn, &ln, &email);
+
+    std::string photo = "PHOTO;ENCODING=b;TYPE=JPEG:";
+    for(int i=0; i<photoBytes; i++)
+        photo += BASE64[next() % 64];
+
+    for(unsigned int pos=0; pos<photo.size(); pos += 74) {
+        if(pos > 0) card += " ";
+        card += photo.substr(pos, 74) + "\r\n";
+    }
+
+    card += "REV:2023-04-01T10:00:00Z\r\n";
+    card += "END:VCARD\r\n";
+    return card;
+}
+
+std::vector<Person> CardGenerator::people(int count) {
+    std::vector<Person> result;
+    for(int i=0; i<count; i++) {
+        Person p;
+        std::string email;
+        p.rawCardData = header(&p.FirstName, &p.LastName, &email);
+        p.rawCardData += "END:VCARD\r\n";
+        p.Emails.push_back(email);
+        p.lastUpdatedAt = "2023-04-01T10:00:00Z";
+        p.section = "bench";
+        result.push_back(p);
+    }
+    return result;
+}
+
+std::vector<DavDialect> CardGenerator::dialects() {
+    std::vector<DavDialect> result;
+    DavDialect d;
+
+    d.name = "owncloud";
+    d.multistatusOpen = "<d:multistatus xmlns:d=\"DAV:\" xmlns:card=\"urn:ietf:params:xml:ns:carddav\" xmlns:cs=\"http://calendarserver.org/ns/\">";
+    d.multistatusClose = "</d:multistatus>";
+    d.davPrefix = "d:";
+    d.cardPrefix = "card:";
+    d.encodeEntities = false;
+    result.push_back(d);
+
+    d.name = "sogo";
+    d.multistatusOpen = "<D:multistatus xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:carddav\">";
+    d.multistatusClose = "</D:multistatus>";
+    d.davPrefix = "D:";
+    d.cardPrefix = "C:";
+    d.encodeEntities = true;
+    result.push_back(d);
+
+    d.name = "radicale";
+    d.multistatusOpen = "<multistatus xmlns=\"DAV:\" xmlns:CR=\"urn:ietf:params:xml:ns:carddav\" xmlns:CS=\"http://calendarserver.org/ns/\">";
+    d.multistatusClose = "</multistatus>";
+    d.davPrefix = "";
+    d.cardPrefix = "CR:";
+    d.encodeEntities = false;
+    result.push_back(d);
+
+    d.name = "xandikos";
+    d.multistatusOpen = "<ns0:multistatus xmlns:ns0=\"DAV:\" xmlns:ns1=\"urn:ietf:params:xml:ns:carddav\">";
+    d.multistatusClose = "</ns0:multistatus>";
+    d.davPrefix = "ns0:";
+    d.cardPrefix = "ns1:";
+    d.encodeEntities = false;
+    result.push_back(d);
+
+    d.name = "davical";
+    d.multistatusOpen = "<multistatus xmlns=\"DAV:\" xmlns:VC=\"urn:ietf:params:xml:ns:carddav\">";
+    d.multistatusClose = "</multistatus>";
+    d.davPrefix = "";
+    d.cardPrefix = "VC:";
+    d.encodeEntities = false;
+    result.push_back(d);
+
+    return result;
+}
+
+bool CardGenerator::findDialect(const std::string &name, DavDialect *dialect) {
+    std::vector<DavDialect> all = dialects();
+    for(unsigned int i=0; i<all.size(); i++) {
+        if(all.at(i).name == name) {
+            *dialect = all.at(i);
+            return true;
+        }
+    }
+    return false;
+}
+
+// escapes a card for use inside address-data, the way the server would do it
+std::string CardGenerator::escapeXml(const DavDialect &dialect, const std::string &card) {
+    std::string result;
+    for(unsigned int i=0; i<card.size(); i++) {
+        unsigned char c = card[i];
+        if(c == '\r') {
+            result += "&#13;";
+        } else if(c == '&') {
+            result += dialect.encodeEntities ? "&#38;" : "&amp;";
+        } else if(c == '<') {
+            result += dialect.encodeEntities ? "&#60;" : "&lt;";
+        } else if(c == '>') {
+            result += dialect.encodeEntities ? "&#62;" : "&gt;";
+        } else if(dialect.encodeEntities && (c == 0xC2 || c == 0xC3) && i + 1 < card.size()) {
+            // two byte utf-8 sequence of the latin-1 range
+            int codepoint = ((c & 0x1F) << 6) | (card[i+1] & 0x3F);
+            std::stringstream ss;
+            ss << "&#" << codepoint << ";";
+            result += ss.str();
+            i++;
+        } else {
+            result += (char)c;
+        }
+    }
+    return result;
+}
+
+std::string CardGenerator::propfindResponse(const DavDialect &dialect, const std::string &basePath, int cards) {
+    const std::string& d = dialect.davPrefix;
+    std::stringstream ss;
+    ss << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" << dialect.multistatusOpen;
+
+    // the collection itself comes first
+    ss << "<" << d << "response><" << d << "href>" << basePath << "</" << d << "href>";
+    ss << "<" << d << "propstat><" << d << "prop><getctag xmlns=\"http://calendarserver.org/ns/\">ctag-" << cards << "</getctag></" << d << "prop>";
+    ss << "<" << d << "status>HTTP/1.1 200 OK</" << d << "status></" << d << "propstat></" << d << "response>\n";
+
+    for(int i=0; i<cards; i++) {
+        ss << "<" << d << "response><" << d << "href>" << basePath << "card-" << i << ".vcf</" << d << "href>";
+        ss << "<" << d << "propstat><" << d << "prop><" << d << "getetag>\"etag-" << i << "\"</" << d << "getetag></" << d << "prop>";
+        ss << "<" << d << "status>HTTP/1.1 200 OK</" << d << "status></" << d << "propstat></" << d << "response>\n";
+    }
+
+    ss << dialect.multistatusClose << "\n";
+    return ss.str();
+}
+
+std::string CardGenerator::reportResponse(const DavDialect &dialect, const std::string &basePath, const std::vector<std::string> &cards) {
+    const std::string& d = dialect.davPrefix;
+    const std::string& c = dialect.cardPrefix;
+    std::stringstream ss;
+    ss << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" << dialect.multistatusOpen;
+
+    for(unsigned int i=0; i<cards.size(); i++) {
+        ss << "<" << d << "response><" << d << "href>" << basePath << "card-" << i << ".vcf</" << d << "href>";
+        ss << "<" << d << "propstat><" << d << "prop><" << d << "getetag>\"etag-" << i << "\"</" << d << "getetag>";
+        ss << "<" << c << "address-data>" << escapeXml(dialect, cards.at(i)) << "</" << c << "address-data>";
+        ss << "</" << d << "prop><" << d << "status>HTTP/1.1 200 OK</" << d << "status></" << d << "propstat></" << d << "response>\n";
+    }
+
+    ss << dialect.multistatusClose << "\n";
+    return ss.str();
+}
@@ -0,0 +1,48 @@
+#ifndef CARDGENERATOR_H
+#define CARDGENERATOR_H
+
+#include <string>
+#include <vector>
+#include "person.h"
+
+// Describes how a carddav server spells its multistatus responses.
+// These are exactly the variants CardCurler sniffs for.
+struct DavDialect
+{
+    std::string name;
+    std::string multistatusOpen;
+    std::string multistatusClose;
+    std::string davPrefix;      // prefix of DAV: elements, may be empty
+    std::string cardPrefix;     // prefix of the carddav namespace
+    bool encodeEntities;        // SOGo sends non ascii chars as html entities
+};
+
+// Deterministic generator for synthetic vcards and carddav responses.
+// The same seed always produces the same address book.
+class CardGenerator
+{
+public:
+    explicit CardGenerator(unsigned int seed = 42);
+
+    std::string smallCard();
+    std::string largeCard();
+    std::string photoCard(int photoBytes = 24000);
+
+    std::string propfindResponse(const DavDialect& dialect, const std::string& basePath, int cards);
+    std::string reportResponse(const DavDialect& dialect, const std::string& basePath, const std::vector<std::string>& cards);
+    std::vector<Person> people(int count);
+
+    static std::vector<DavDialect> dialects();
+    static bool findDialect(const std::string& name, DavDialect* dialect);
+    static std::string escapeXml(const DavDialect& dialect, const std::string& card);
+
+private:
+    unsigned int state;
+    int serial;
+
+    unsigned int next();
+    std::string pick(const char* const* list, int size);
+    std::string header(std::string* firstName, std::string* lastName, std::string* email);
+};
+
+#endif // CARDGENERATOR_H
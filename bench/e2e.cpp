@@ -0,0 +1,85 @@
+// End to end sync and search against MockDavServer, for each dialect the
+// code knows about. Reports wall time, requests issued and bytes transferred.
+//
+// usage: muttvcardsearch_e2e [--cards=N] [--latency-ms=N] [--dialect=NAME] [--query=TEXT]
+
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <chrono>
+#include <stdlib.h>
+#include "cardcurler.h"
+#include "searchtemplates.h"
+#include "stringutils.h"
+#include "url.h"
+#include "mockdavserver.h"
+
+static std::string argValue(int argc, char *argv[], const std::string& name, const std::string& fallback) {
+    for(int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if(arg.compare(0, name.size() + 1, name + "=") == 0)
+            return arg.substr(name.size() + 1);
+    }
+    return fallback;
+}
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+static void report(const std::string& dialect, const std::string& phase, double seconds, size_t cards, const MockDavServer& server) {
+    std::cout << std::left << std::setw(10) << dialect << std::setw(8) << phase
+              << std::right << std::setw(10) << std::fixed << std::setprecision(1) << seconds * 1000 << " ms"
+              << std::setw(8) << cards << " cards"
+              << std::setw(8) << server.requests() << " req"
+              << std::setw(12) << server.bytesReceived() << " B up"
+              << std::setw(12) << server.bytesSent() << " B down" << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    int cards = atoi(argValue(argc, argv, "--cards", "1000").c_str());
+    int latency = atoi(argValue(argc, argv, "--latency-ms", "0").c_str());
+    std::string only = argValue(argc, argv, "--dialect", "");
+    std::string search = argValue(argc, argv, "--query", "smith");
+
+    SearchTemplates st;
+    std::vector<DavDialect> dialects = CardGenerator::dialects();
+
+    for(unsigned int i=0; i<dialects.size(); i++) {
+        const DavDialect& dialect = dialects.at(i);
+        if(only.size() > 0 && only != dialect.name)
+            continue;
+
+        MockDavServer server(dialect, cards, latency);
+        if(false == server.start())
+            return 1;
+
+        // getAllCards reports every card on stdout
+        std::streambuf* out = std::cout.rdbuf();
+        std::stringstream discard;
+
+        CardCurler sync("bench", "bench", server.url(), search);
+        std::cout.rdbuf(discard.rdbuf());
+        double start = now();
+        std::vector<Person> people = sync.getAllCards(Url::removePath(server.url()), st.getDefaultExportTemplate());
+        double elapsed = now() - start;
+        std::cout.rdbuf(out);
+        report(dialect.name, "sync", elapsed, people.size(), server);
+
+        server.resetCounters();
+        std::string query = SearchTemplates::buildSearchQuery(st.getDefaultSearchTemplate(), search, DEFAULT_SEARCH_LIMIT);
+
+        CardCurler online("bench", "bench", server.url(), search);
+        start = now();
+        people = online.curlCard(query);
+        elapsed = now() - start;
+        report(dialect.name, "search", elapsed, people.size(), server);
+
+        server.stop();
+    }
+
+    return 0;
+}
@@ -0,0 +1,64 @@
+// Runs MockDavServer standalone, i.e. to point a muttvcardsearch
+// configuration at it for load tests.
+//
+// usage: muttvcardsearch_mockdav [--port=N] [--cards=N] [--latency-ms=N] [--dialect=NAME] [--fail-every=N] [--changed=N]
+//   --fail-every=N answers every Nth GET with 503
+//   --changed=N serves the first N cards edited, i.e. restart with it
+//     between two syncs to see them revalidated
+
+#include <iostream>
+#include <string>
+#include <csignal>
+#include <stdlib.h>
+#include <unistd.h>
+#include "mockdavserver.h"
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void onSignal(int) {
+    stopRequested = 1;
+}
+
+static std::string argValue(int argc, char *argv[], const std::string& name, const std::string& fallback) {
+    for(int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if(arg.compare(0, name.size() + 1, name + "=") == 0)
+            return arg.substr(name.size() + 1);
+    }
+    return fallback;
+}
+
+int main(int argc, char *argv[])
+{
+    int port = atoi(argValue(argc, argv, "--port", "8008").c_str());
+    int cards = atoi(argValue(argc, argv, "--cards", "1000").c_str());
+    int latency = atoi(argValue(argc, argv, "--latency-ms", "0").c_str());
+    std::string name = argValue(argc, argv, "--dialect", "owncloud");
+
+    DavDialect dialect;
+    if(false == CardGenerator::findDialect(name, &dialect)) {
+        std::cerr << "Unknown dialect '" << name << "', use owncloud, sogo, radicale, xandikos or davical" << std::endl;
+        return 1;
+    }
+
+    MockDavServer server(dialect, cards, latency);
+    server.setFailEvery(atoi(argValue(argc, argv, "--fail-every", "0").c_str()));
+    int changed = atoi(argValue(argc, argv, "--changed", "0").c_str());
+    if(changed > 0)
+        server.changeCards(changed);
+    if(false == server.start(port))
+        return 1;
+
+    signal(SIGINT, onSignal);
+    signal(SIGTERM, onSignal);
+
+    std::cout << "Serving " << cards << " " << name << " cards on " << server.url() << std::endl;
+    while(!stopRequested)
+        pause();
+
+    server.stop();
+    std::cout << server.requests() << " requests, "
+              << server.bytesReceived() << " bytes received, "
+              << server.bytesSent() << " bytes sent" << std::endl;
+    return 0;
+}
@@ -0,0 +1,528 @@
+#include "mockdavserver.h"
+#include <sstream>
+#include <iomanip>
+#include <algorithm>
+#include <iostream>
+#include <chrono>
+#include <cstring>
+#include <cerrno>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/socket.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <arpa/inet.h>
+
+#define MOCK_BASE_PATH "/dav/contacts/"
+
+MockDavServer::MockDavServer(const DavDialect &dialect, int cards, int latencyMs)
+    : dialect(dialect),
+      latencyMs(latencyMs),
+      failEvery(0),
+      numGets(0),
+      listenFd(-1),
+      listenPort(0),
+      running(false),
+      numRequests(0),
+      numBytesIn(0),
+      numBytesOut(0)
+{
+    // mostly small cards, some large ones and a few with photos, like a real book
+    CardGenerator gen;
+    for(int i=0; i<cards; i++) {
+        std::string card;
+        if(i % 50 == 49)
+            card = gen.photoCard(8000);
+        else if(i % 10 == 9)
+            card = gen.largeCard();
+        else
+            card = gen.smallCard();
+
+        // what an addressbook-query on FN or EMAIL can match
+        std::string searchable;
+        std::stringstream ss(card);
+        std::string line;
+        while(std::getline(ss, line)) {
+            if(line.compare(0, 3, "FN:") == 0 || line.find("EMAIL") != std::string::npos) {
+                size_t colon = line.find(':');
+                searchable += toLower(line.substr(colon + 1)) + "\n";
+            }
+        }
+
+        this->cards.push_back(card);
+        this->searchable.push_back(searchable);
+        this->revisions.push_back(0);
+    }
+
+    std::stringstream tag;
+    tag << "ctag-" << cards;
+    ctag = tag.str();
+}
+
+MockDavServer::~MockDavServer() {
+    stop();
+}
+
+bool MockDavServer::start(int port) {
+    listenFd = socket(AF_INET, SOCK_STREAM, 0);
+    if(listenFd < 0) {
+        std::cerr << "MockDavServer: unable to create socket" << std::endl;
+        return false;
+    }
+
+    int one = 1;
+    setsockopt(listenFd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    struct sockaddr_in addr;
+    memset(&addr, 0, sizeof(addr));
+    addr.sin_family = AF_INET;
+    addr.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+    addr.sin_port = htons(port);
+
+    if(bind(listenFd, (struct sockaddr*)&addr, sizeof(addr)) != 0 || listen(listenFd, 64) != 0) {
+        std::cerr << "MockDavServer: unable to listen on port " << port << ": " << strerror(errno) << std::endl;
+        close(listenFd);
+        listenFd = -1;
+        return false;
+    }
+
+    socklen_t len = sizeof(addr);
+    getsockname(listenFd, (struct sockaddr*)&addr, &len);
+    listenPort = ntohs(addr.sin_port);
+
+    running = true;
+    acceptThread = std::thread(&MockDavServer::acceptLoop, this);
+    return true;
+}
+
+void MockDavServer::stop() {
+    if(false == running)
+        return;
+
+    running = false;
+    shutdown(listenFd, SHUT_RDWR);
+    close(listenFd);
+    listenFd = -1;
+
+    if(acceptThread.joinable())
+        acceptThread.join();
+
+    // wake up workers blocked in recv()
+    {
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        for(unsigned int i=0; i<clients.size(); i++)
+            shutdown(clients.at(i), SHUT_RDWR);
+    }
+
+    for(unsigned int i=0; i<workers.size(); i++) {
+        if(workers.at(i).joinable())
+            workers.at(i).join();
+    }
+    workers.clear();
+}
+
+int MockDavServer::port() const {
+    return listenPort;
+}
+
+std::string MockDavServer::basePath() const {
+    return MOCK_BASE_PATH;
+}
+
+std::string MockDavServer::url() const {
+    std::stringstream ss;
+    ss << "http://127.0.0.1:" << listenPort << MOCK_BASE_PATH;
+    return ss.str();
+}
+
+long MockDavServer::requests() const {
+    return numRequests;
+}
+
+long MockDavServer::bytesReceived() const {
+    return numBytesIn;
+}
+
+long MockDavServer::bytesSent() const {
+    return numBytesOut;
+}
+
+void MockDavServer::resetCounters() {
+    numRequests = 0;
+    numBytesIn = 0;
+    numBytesOut = 0;
+}
+
+void MockDavServer::acceptLoop() {
+    while(running) {
+        int fd = accept(listenFd, NULL, NULL);
+        if(fd < 0) {
+            if(running) continue;
+            break;
+        }
+
+        int one = 1;
+        setsockopt(fd, IPPROTO_TCP, TCP_NODELAY, &one, sizeof(one));
+
+        std::lock_guard<std::mutex> lock(clientsMutex);
+        clients.push_back(fd);
+        workers.push_back(std::thread(&MockDavServer::serve, this, fd));
+    }
+}
+
+// one thread per connection, requests on a connection are answered in order
+void MockDavServer::serve(int fd) {
+    std::string buffer;
+    Request request;
+
+    while(running && readRequest(fd, &buffer, &request)) {
+        numRequests++;
+
+        if(latencyMs > 0)
+            std::this_thread::sleep_for(std::chrono::milliseconds(latencyMs));
+
+        if(request.method == "PROPFIND")
+            handlePropfind(fd, request);
+        else if(request.method == "REPORT")
+            handleReport(fd, request);
+        else if(request.method == "GET")
+            handleGet(fd, request);
+        else
+            sendResponse(fd, 405, "text/plain", "method not allowed\n");
+
+        if(request.headers["connection"] == "close")
+            break;
+    }
+
+    std::lock_guard<std::mutex> lock(clientsMutex);
+    clients.erase(std::remove(clients.begin(), clients.end(), fd), clients.end());
+    close(fd);
+}
+
+bool MockDavServer::readRequest(int fd, std::string *buffer, Request *request) {
+    char chunk[16384];
+
+    size_t headerEnd;
+    while((headerEnd = buffer->find("\r\n\r\n")) == std::string::npos) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0) return false;
+        buffer->append(chunk, n);
+    }
+
+    std::string head = buffer->substr(0, headerEnd);
+    buffer->erase(0, headerEnd + 4);
+    numBytesIn += headerEnd + 4;
+
+    request->headers.clear();
+    request->body.clear();
+
+    std::stringstream ss(head);
+    std::string line;
+    std::getline(ss, line);
+    std::stringstream requestLine(line);
+    requestLine >> request->method >> request->path;
+
+    while(std::getline(ss, line)) {
+        if(line.size() > 0 && line[line.size()-1] == '\r')
+            line.erase(line.size()-1);
+        size_t colon = line.find(':');
+        if(colon == std::string::npos) continue;
+        std::string value = line.substr(colon + 1);
+        value.erase(0, value.find_first_not_of(' '));
+        request->headers[toLower(line.substr(0, colon))] = value;
+    }
+
+    if(toLower(request->headers["expect"]) == "100-continue") {
+        std::string cont = "HTTP/1.1 100 Continue\r\n\r\n";
+        send(fd, cont.data(), cont.size(), MSG_NOSIGNAL);
+    }
+
+    size_t length = atol(request->headers["content-length"].c_str());
+    while(buffer->size() < length) {
+        ssize_t n = recv(fd, chunk, sizeof(chunk), 0);
+        if(n <= 0) return false;
+        buffer->append(chunk, n);
+    }
+
+    request->body = buffer->substr(0, length);
+    buffer->erase(0, length);
+    numBytesIn += length;
+    return true;
+}
+
+bool MockDavServer::sendResponse(int fd, int status, const std::string &contentType, const std::string &body, const std::string &extraHeaders) {
+    std::string reason = "OK";
+    switch(status) {
+    case 207: reason = "Multi-Status"; break;
+    case 304: reason = "Not Modified"; break;
+    case 400: reason = "Bad Request"; break;
+    case 404: reason = "Not Found"; break;
+    case 405: reason = "Method Not Allowed"; break;
+    case 503: reason = "Service Unavailable"; break;
+    }
+
+    std::stringstream ss;
+    ss << "HTTP/1.1 " << status << " " << reason << "\r\n";
+    ss << "Content-Type: " << contentType << "\r\n";
+    ss << "Content-Length: " << body.size() << "\r\n";
+    ss << extraHeaders;
+    ss << "\r\n";
+    std::string response = ss.str() + body;
+
+    // counted up front: the client may have read the response and asked
+    // for bytesSent() before send() returns here
+    numBytesOut += response.size();
+
+    size_t sent = 0;
+    while(sent < response.size()) {
+        ssize_t n = send(fd, response.data() + sent, response.size() - sent, MSG_NOSIGNAL);
+        if(n <= 0) return false;
+        sent += n;
+    }
+
+    return true;
+}
+
+void MockDavServer::handlePropfind(int fd, const Request &request) {
+    const std::string& d = dialect.davPrefix;
+    std::map<std::string, std::string>::const_iterator depth = request.headers.find("depth");
+    bool collectionOnly = depth != request.headers.end() && depth->second == "0";
+
+    // the collection itself comes first
+    std::stringstream ss;
+    ss << "<" << d << "response><" << d << "href>" << MOCK_BASE_PATH << "</" << d << "href>";
+    ss << "<" << d << "propstat><" << d << "prop><CS:getctag xmlns:CS=\"http://calendarserver.org/ns/\">" << ctag << "</CS:getctag></" << d << "prop>";
+    ss << "<" << d << "status>HTTP/1.1 200 OK</" << d << "status></" << d << "propstat></" << d << "response>\n";
+
+    if(false == collectionOnly) {
+        std::vector<int> all;
+        for(unsigned int i=0; i<cards.size(); i++)
+            all.push_back(i);
+        ss << responses(all, false);
+    }
+
+    sendResponse(fd, 207, "application/xml; charset=utf-8", multistatus(ss.str()));
+}
+
+void MockDavServer::handleReport(int fd, const Request &request) {
+    const std::string& body = request.body;
+    std::vector<int> result;
+    size_t pos = 0;
+
+    if(body.find("addressbook-query") != std::string::npos) {
+        std::vector<std::string> matches;
+        std::string text;
+        while((text = elementText(body, "text-match", &pos)).size() > 0 || pos != std::string::npos) {
+            if(text.size() > 0)
+                matches.push_back(toLower(unescapeXml(text)));
+        }
+
+        pos = 0;
+        int limit = atoi(elementText(body, "nresults", &pos).c_str());
+
+        for(unsigned int i=0; i<cards.size(); i++) {
+            if(limit > 0 && (int)result.size() >= limit)
+                break;
+            for(unsigned int m=0; m<matches.size(); m++) {
+                if(searchable.at(i).find(matches.at(m)) != std::string::npos) {
+                    result.push_back(i);
+                    break;
+                }
+            }
+        }
+
+        sendResponse(fd, 207, "application/xml; charset=utf-8", multistatus(responses(result, true)));
+
+    } else if(body.find("addressbook-multiget") != std::string::npos) {
+        std::string href;
+        while((href = elementText(body, "href", &pos)).size() > 0 || pos != std::string::npos) {
+            int index = cardIndex(href);
+            if(index >= 0)
+                result.push_back(index);
+        }
+
+        sendResponse(fd, 207, "application/xml; charset=utf-8", multistatus(responses(result, true)));
+
+    } else if(body.find("sync-collection") != std::string::npos) {
+        for(unsigned int i=0; i<cards.size(); i++)
+            result.push_back(i);
+
+        sendResponse(fd, 207, "application/xml; charset=utf-8", multistatus(responses(result, true), ctag));
+
+    } else {
+        sendResponse(fd, 400, "text/plain", "unsupported report\n");
+    }
+}
+
+void MockDavServer::setFailEvery(int n) {
+    failEvery = n;
+}
+
+void MockDavServer::changeCards(int count) {
+    for(int i=0; i<count && i<(int)cards.size(); i++) {
+        revisions[i]++;
+
+        std::stringstream note;
+        note << "NOTE:revision " << revisions[i] << "\r\nEND:VCARD";
+        size_t end = cards[i].rfind("END:VCARD");
+        cards[i].replace(end, 9, note.str());
+    }
+
+    // every edit counts, like a server bumping its sync token
+    long edits = 0;
+    for(unsigned int i=0; i<revisions.size(); i++)
+        edits += revisions[i];
+
+    std::stringstream tag;
+    tag << "ctag-" << cards.size() << "-" << edits;
+    ctag = tag.str();
+}
+
+void MockDavServer::handleGet(int fd, const Request &request) {
+    int every = failEvery.load();
+    if(every > 0 && ++numGets % every == 0) {
+        sendResponse(fd, 503, "text/plain", "try again later\n");
+        return;
+    }
+
+    int index = cardIndex(request.path);
+    if(index < 0) {
+        sendResponse(fd, 404, "text/plain", "not found\n");
+        return;
+    }
+
+    // If-None-Match wins over If-Modified-Since, like RFC 7232 asks
+    std::map<std::string, std::string>::const_iterator match = request.headers.find("if-none-match");
+    std::map<std::string, std::string>::const_iterator since = request.headers.find("if-modified-since");
+    bool notModified = match != request.headers.end()
+            ? match->second == etag(index)
+            : since != request.headers.end() && since->second == lastModified(index);
+
+    std::string validators = "ETag: " + etag(index) + "\r\nLast-Modified: " + lastModified(index) + "\r\n";
+    if(notModified)
+        sendResponse(fd, 304, "text/vcard; charset=utf-8", "", validators);
+    else
+        sendResponse(fd, 200, "text/vcard; charset=utf-8", cards.at(index), validators);
+}
+
+// "etag-<index>", with the revision appended once the card changed
+std::string MockDavServer::etag(int index) const {
+    std::stringstream ss;
+    ss << "\"etag-" << index;
+    if(revisions.at(index) > 0)
+        ss << "." << revisions.at(index);
+    ss << "\"";
+    return ss.str();
+}
+
+// 1 January 2024 (a monday), one day later for every revision
+std::string MockDavServer::lastModified(int index) const {
+    static const char* weekdays[] = { "Mon", "Tue", "Wed", "Thu", "Fri", "Sat", "Sun" };
+    int day = revisions.at(index) % 28;
+
+    std::stringstream ss;
+    ss << weekdays[day % 7] << ", " << std::setw(2) << std::setfill('0') << day + 1 << " Jan 2024 12:00:00 GMT";
+    return ss.str();
+}
+
+// MOCK_BASE_PATH/card-<index>.vcf
+int MockDavServer::cardIndex(const std::string &href) const {
+    std::string prefix = std::string(MOCK_BASE_PATH) + "card-";
+    size_t pos = href.find(prefix);
+    if(pos == std::string::npos)
+        return -1;
+
+    int index = atoi(href.c_str() + pos + prefix.size());
+    if(index < 0 || index >= (int)cards.size())
+        return -1;
+
+    return index;
+}
+
+std::string MockDavServer::responses(const std::vector<int> &indexes, bool withData) {
+    const std::string& d = dialect.davPrefix;
+    const std::string& c = dialect.cardPrefix;
+
+    std::stringstream ss;
+    for(unsigned int i=0; i<indexes.size(); i++) {
+        int index = indexes.at(i);
+        ss << "<" << d << "response><" << d << "href>" << MOCK_BASE_PATH << "card-" << index << ".vcf</" << d << "href>";
+        ss << "<" << d << "propstat><" << d << "prop><" << d << "getetag>" << etag(index) << "</" << d << "getetag>";
+        if(withData)
+            ss << "<" << c << "address-data>" << CardGenerator::escapeXml(dialect, cards.at(index)) << "</" << c << "address-data>";
+        ss << "</" << d << "prop><" << d << "status>HTTP/1.1 200 OK</" << d << "status></" << d << "propstat></" << d << "response>\n";
+    }
+    return ss.str();
+}
+
+std::string MockDavServer::multistatus(const std::string &responses, const std::string &syncToken) {
+    const std::string& d = dialect.davPrefix;
+
+    std::stringstream ss;
+    ss << "<?xml version=\"1.0\" encoding=\"utf-8\"?>\n" << dialect.multistatusOpen << "\n" << responses;
+    if(syncToken.size() > 0)
+        ss << "<" << d << "sync-token>" << syncToken << "</" << d << "sync-token>\n";
+    ss << dialect.multistatusClose << "\n";
+    return ss.str();
+}
+
+// Returns the text content of the next element named localName (any namespace
+// prefix) at or after *pos and moves *pos behind it. *pos becomes npos when
+// there are no more such elements.
+std::string MockDavServer::elementText(const std::string &xml, const std::string &localName, size_t *pos) {
+    while(*pos != std::string::npos) {
+        size_t found = xml.find(localName, *pos);
+        if(found == std::string::npos || found == 0) {
+            *pos = std::string::npos;
+            return "";
+        }
+
+        *pos = found + localName.size();
+
+        char before = xml[found - 1];
+        char after = (*pos < xml.size()) ? xml[*pos] : '\0';
+        if((before != '<' && before != ':') || (after != '>' && after != ' ' && after != '/'))
+            continue;
+
+        // skip closing tags
+        size_t tagStart = xml.rfind('<', found);
+        if(tagStart == std::string::npos || xml[tagStart + 1] == '/')
+            continue;
+
+        size_t tagEnd = xml.find('>', *pos);
+        if(tagEnd == std::string::npos) {
+            *pos = std::string::npos;
+            return "";
+        }
+
+        if(xml[tagEnd - 1] == '/') { // <foo/>
+            *pos = tagEnd + 1;
+            return "";
+        }
+
+        size_t textEnd = xml.find('<', tagEnd);
+        *pos = textEnd;
+        return xml.substr(tagEnd + 1, textEnd - tagEnd - 1);
+    }
+
+    return "";
+}
+
+std::string MockDavServer::unescapeXml(const std::string &text) {
+    std::string result = text;
+    const char* entities[][2] = { { "&lt;", "<" }, { "&gt;", ">" }, { "&quot;", "\"" }, { "&apos;", "'" }, { "&amp;", "&" } };
+    for(unsigned int i=0; i<5; i++) {
+        size_t pos = 0;
+        while((pos = result.find(entities[i][0], pos)) != std::string::npos) {
+            result.replace(pos, strlen(entities[i][0]), entities[i][1]);
+            pos += 1;
+        }
+    }
+    return result;
+}
+
+std::string MockDavServer::toLower(const std::string &text) {
+    std::string result = text;
+    std::transform(result.begin(), result.end(), result.begin(), ::tolower);
+    return result;
+}
@@ -0,0 +1,91 @@
+#ifndef MOCKDAVSERVER_H
+#define MOCKDAVSERVER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include "cardgenerator.h"
+
+// A small local stand-in for a carddav server, good enough to drive
+// CardCurler end to end without network access. It serves PROPFIND,
+// REPORT (addressbook-query, addressbook-multiget, sync-collection)
+// and GET for a generated address book and answers in the namespace
+// spelling of the configured dialect.
+class MockDavServer
+{
+public:
+    MockDavServer(const DavDialect& dialect, int cards, int latencyMs = 0);
+    ~MockDavServer();
+
+    bool start(int port = 0);
+    void stop();
+
+    int port() const;
+    std::string url() const;        // the address book url, i.e. http://127.0.0.1:1234/dav/contacts/
+    std::string basePath() const;
+
+    // every Nth GET is answered with 503, to exercise retries. 0 turns it off
+    void setFailEvery(int n);
+
+    // edits the first count cards, which gives them a new etag and
+    // Last-Modified and the address book a new ctag. Call it before start
+    void changeCards(int count);
+
+    long requests() const;
+    long bytesReceived() const;     // request bytes, headers included
+    long bytesSent() const;         // response bytes, headers included
+    void resetCounters();
+
+private:
+    struct Request
+    {
+        std::string method;
+        std::string path;
+        std::map<std::string, std::string> headers; // lower case names
+        std::string body;
+    };
+
+    DavDialect dialect;
+    int latencyMs;
+    std::atomic<int> failEvery;
+    std::atomic<long> numGets;
+    std::string ctag;
+    std::vector<std::string> cards;
+    std::vector<std::string> searchable; // lower case FN and EMAIL values per card
+    std::vector<int> revisions;
+
+    int listenFd;
+    int listenPort;
+    std::atomic<bool> running;
+    std::thread acceptThread;
+    std::vector<std::thread> workers;
+    std::vector<int> clients;
+    std::mutex clientsMutex;
+
+    std::atomic<long> numRequests;
+    std::atomic<long> numBytesIn;
+    std::atomic<long> numBytesOut;
+
+    void acceptLoop();
+    void serve(int fd);
+    bool readRequest(int fd, std::string* buffer, Request* request);
+    bool sendResponse(int fd, int status, const std::string& contentType, const std::string& body, const std::string& extraHeaders = std::string());
+
+    void handlePropfind(int fd, const Request& request);
+    void handleReport(int fd, const Request& request);
+    void handleGet(int fd, const Request& request);
+
+    int cardIndex(const std::string& href) const;
+    std::string etag(int index) const;
+    std::string lastModified(int index) const;
+    std::string responses(const std::vector<int>& indexes, bool withData);
+    std::string multistatus(const std::string& responses, const std::string& syncToken = std::string());
+    static std::string elementText(const std::string& xml, const std::string& localName, size_t* pos);
+    static std::string unescapeXml(const std::string& text);
+    static std::string toLower(const std::string& text);
+};
+
+#endif // MOCKDAVSERVER_H
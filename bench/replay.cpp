@@ -0,0 +1,283 @@
+// Replays a list of queries against the muttvcardsearch binary the way mutt
+// runs it, one process per query, with a given number of queries in flight.
+// Reports queries per second, latency percentiles and how many queries were
+// answered from the cache, online or not at all.
+//
+// Without --home a synthetic setup is used: MockDavServer serves --cards
+// generated cards, a temporary HOME gets a config pointing at it and the
+// cache is built with --create-local-cache. Without --queries a fixed mix of
+// hits and misses is generated, so two runs are comparable.
+//
+// usage: muttvcardsearch_replay [--binary=PATH] [--queries=FILE] [--concurrency=N]
+//                               [--home=DIR] [--cards=N] [--latency-ms=N] [--count=N]
+
+#include <iostream>
+#include <iomanip>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <map>
+#include <thread>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <algorithm>
+#include <stdlib.h>
+#include <string.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <spawn.h>
+#include <sys/wait.h>
+#include "fileutils.h"
+#include "mockdavserver.h"
+
+#ifndef REPLAY_DEFAULT_BINARY
+#define REPLAY_DEFAULT_BINARY "muttvcardsearch"
+#endif
+
+extern char **environ;
+
+struct Result
+{
+    double seconds;
+    std::string path; // as reported by --stats=json
+    int exitCode;
+};
+
+static std::string argValue(int argc, char *argv[], const std::string& name, const std::string& fallback) {
+    for(int i=1; i<argc; i++) {
+        std::string arg(argv[i]);
+        if(arg.compare(0, name.size() + 1, name + "=") == 0)
+            return arg.substr(name.size() + 1);
+    }
+    return fallback;
+}
+
+static double now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+// runs binary with args and HOME set to home, stdout goes to /dev/null and
+// stderr is returned in *err
+static int run(const std::string& binary, const std::vector<std::string>& args, const std::string& home, std::string* err) {
+    std::vector<std::string> env;
+    for(char** e = environ; *e; e++) {
+        if(strncmp(*e, "HOME=", 5) != 0)
+            env.push_back(*e);
+    }
+    env.push_back("HOME=" + home);
+
+    std::vector<char*> argv, envp;
+    argv.push_back(const_cast<char*>(binary.c_str()));
+    for(unsigned int i=0; i<args.size(); i++)
+        argv.push_back(const_cast<char*>(args.at(i).c_str()));
+    argv.push_back(NULL);
+    for(unsigned int i=0; i<env.size(); i++)
+        envp.push_back(const_cast<char*>(env.at(i).c_str()));
+    envp.push_back(NULL);
+
+    int fds[2];
+    if(pipe2(fds, O_CLOEXEC) != 0)
+        return -1;
+
+    posix_spawn_file_actions_t actions;
+    posix_spawn_file_actions_init(&actions);
+    posix_spawn_file_actions_addopen(&actions, 1, "/dev/null", O_WRONLY, 0);
+    posix_spawn_file_actions_adddup2(&actions, fds[1], 2);
+
+    pid_t pid;
+    int rc = posix_spawn(&pid, binary.c_str(), &actions, NULL, argv.data(), envp.data());
+    posix_spawn_file_actions_destroy(&actions);
+    close(fds[1]);
+
+    if(rc != 0) {
+        close(fds[0]);
+        std::cerr << "Can't run " << binary << ": " << strerror(rc) << std::endl;
+        return -1;
+    }
+
+    char buffer[4096];
+    ssize_t n;
+    while((n = read(fds[0], buffer, sizeof(buffer))) > 0)
+        err->append(buffer, n);
+    close(fds[0]);
+
+    int status = 0;
+    waitpid(pid, &status, 0);
+    return WIFEXITED(status) ? WEXITSTATUS(status) : -1;
+}
+
+static std::string pathFromStats(const std::string& json) {
+    std::string key = "\"path\":\"";
+    size_t pos = json.rfind(key);
+    if(pos == std::string::npos)
+        return "unknown";
+
+    pos += key.size();
+    return json.substr(pos, json.find('"', pos) - pos);
+}
+
+static double percentile(const std::vector<double>& sorted, double p) {
+    if(sorted.size() == 0)
+        return 0;
+    return sorted.at((size_t)(p * (sorted.size() - 1) + 0.5));
+}
+
+// a fixed mix of last names in the generated address book and names nobody has
+static std::vector<std::string> generateQueries(int count) {
+    CardGenerator gen(4711);
+    std::vector<Person> people = gen.people(count);
+    std::vector<std::string> queries;
+    for(int i=0; i<count; i++) {
+        if(i % 10 == 9) {
+            std::stringstream ss;
+            ss << "nobody" << i;
+            queries.push_back(ss.str());
+        } else {
+            queries.push_back(people.at(i).LastName);
+        }
+    }
+    return queries;
+}
+
+static void printRow(const std::string& name, std::vector<double> latencies, int total) {
+    std::sort(latencies.begin(), latencies.end());
+    std::cout << std::left << std::setw(12) << name << std::right << std::setw(8) << latencies.size()
+              << std::setw(8) << std::setprecision(1) << latencies.size() * 100.0 / total << "%"
+              << std::setprecision(2)
+              << std::setw(11) << percentile(latencies, 0.50) * 1000
+              << std::setw(11) << percentile(latencies, 0.90) * 1000
+              << std::setw(11) << percentile(latencies, 0.99) * 1000
+              << std::setw(11) << (latencies.size() ? latencies.back() * 1000 : 0) << std::endl;
+}
+
+int main(int argc, char *argv[])
+{
+    std::string binary = argValue(argc, argv, "--binary", REPLAY_DEFAULT_BINARY);
+    std::string queryFile = argValue(argc, argv, "--queries", "");
+    std::string home = argValue(argc, argv, "--home", "");
+    int concurrency = std::max(1, atoi(argValue(argc, argv, "--concurrency", "4").c_str()));
+    int cards = atoi(argValue(argc, argv, "--cards", "1000").c_str());
+    int latency = atoi(argValue(argc, argv, "--latency-ms", "0").c_str());
+    int count = atoi(argValue(argc, argv, "--count", "500").c_str());
+
+    std::vector<std::string> queries;
+    if(queryFile.size() > 0) {
+        std::ifstream f(queryFile.c_str());
+        if(false == f.is_open()) {
+            std::cerr << "Can't open query file '" << queryFile << "'" << std::endl;
+            return 1;
+        }
+        std::string line;
+        while(std::getline(f, line)) {
+            if(line.size() > 0)
+                queries.push_back(line);
+        }
+    } else {
+        queries = generateQueries(count);
+    }
+
+    if(queries.size() == 0) {
+        std::cerr << "No queries to replay" << std::endl;
+        return 1;
+    }
+
+    // synthetic setup: mock server, config and cache in a temporary HOME
+    DavDialect dialect;
+    CardGenerator::findDialect("owncloud", &dialect);
+    MockDavServer server(dialect, cards, latency);
+    bool synthetic = home.size() == 0;
+
+    if(synthetic) {
+        char tmpl[] = "/tmp/muttvcardsearch-replay-XXXXXX";
+        if(mkdtemp(tmpl) == NULL) {
+            std::cerr << "Unable to create temporary directory" << std::endl;
+            return 1;
+        }
+        home = tmpl;
+        mkdir((home + "/.config").c_str(), 0700);
+        mkdir((home + "/.config/muttvcardsearch").c_str(), 0700);
+
+        if(false == server.start())
+            return 1;
+
+        std::vector<std::string> configure;
+        configure.push_back("--name=replay");
+        configure.push_back("--server=" + server.url());
+        configure.push_back("--username=replay");
+        configure.push_back("--password=replay");
+
+        std::vector<std::string> create;
+        create.push_back("--create-local-cache");
+
+        std::string err;
+        if(run(binary, configure, home, &err) != 0 || run(binary, create, home, &err) != 0) {
+            std::cerr << "Synthetic setup failed: " << err << std::endl;
+            return 1;
+        }
+
+        std::cout << "Replaying against " << cards << " mock cards, cache in " << home << std::endl;
+    }
+
+    std::vector<Result> results(queries.size());
+    std::atomic<size_t> nextQuery(0);
+    std::vector<std::thread> workers;
+
+    double start = now();
+    for(int w=0; w<concurrency; w++) {
+        workers.push_back(std::thread([&]() {
+            size_t i;
+            while((i = nextQuery.fetch_add(1)) < queries.size()) {
+                std::vector<std::string> args;
+                args.push_back(queries.at(i));
+                args.push_back("--stats=json");
+
+                std::string err;
+                double begin = now();
+                results[i].exitCode = run(binary, args, home, &err);
+                results[i].seconds = now() - begin;
+                results[i].path = pathFromStats(err);
+            }
+        }));
+    }
+    for(unsigned int w=0; w<workers.size(); w++)
+        workers.at(w).join();
+    double elapsed = now() - start;
+
+    std::map<std::string, std::vector<double> > paths;
+    std::vector<double> all;
+    int failed = 0;
+    for(unsigned int i=0; i<results.size(); i++) {
+        paths[results.at(i).path].push_back(results.at(i).seconds);
+        all.push_back(results.at(i).seconds);
+        if(results.at(i).exitCode != 0)
+            failed++;
+    }
+
+    std::cout << std::fixed << std::setprecision(1);
+    std::cout << queries.size() << " queries, concurrency " << concurrency << ", " << elapsed << " s, "
+              << queries.size() / elapsed << " queries/s";
+    if(failed > 0)
+        std::cout << ", " << failed << " failed";
+    std::cout << std::endl << std::endl;
+
+    std::cout << std::left << std::setw(12) << "path" << std::right << std::setw(8) << "queries" << std::setw(9) << "share"
+              << std::setw(11) << "p50 ms" << std::setw(11) << "p90 ms" << std::setw(11) << "p99 ms" << std::setw(11) << "max ms" << std::endl;
+    for(std::map<std::string, std::vector<double> >::const_iterator it = paths.begin(); it != paths.end(); ++it)
+        printRow(it->first, it->second, results.size());
+    printRow("all", all, results.size());
+
+    if(synthetic) {
+        server.stop();
+        std::string dir = home + "/.config/muttvcardsearch";
+        FileUtils::fileRemove(dir + "/muttvcardsearch.conf");
+        FileUtils::fileRemove(dir + "/cache.sqlite3");
+        FileUtils::fileRemove(dir + "/stats.sqlite3");
+        rmdir(dir.c_str());
+        rmdir((home + "/.config").c_str());
+        rmdir(home.c_str());
+    }
+
+    return failed > 0 ? 1 : 0;
+}
@@ -0,0 +1,147 @@
+#ifndef BOUNDEDQUEUE_H
+#define BOUNDEDQUEUE_H
+
+#include <atomic>
+#include <thread>
+#include <chrono>
+#include <utility>
+#include <stddef.h>
+
+// A fixed size queue any number of threads push to and pop from without a
+// lock (Dmitry Vyukov's bounded MPMC queue). Every cell carries a sequence
+// number telling whether it is free for the next push or holds the next
+// pop, so producers and consumers only ever race for a position counter.
+// push and pop wait while the queue is full or empty, first yielding and
+// then sleeping, which keeps an idle stage off the cpu.
+template <typename T>
+class BoundedQueue
+{
+public:
+    // capacity is rounded up to a power of two
+    explicit BoundedQueue(size_t capacity)
+        : enqueuePos(0),
+          dequeuePos(0),
+          closed(false)
+    {
+        size_t size = 2;
+        while(size < capacity)
+            size *= 2;
+
+        cells = new Cell[size];
+        mask = size - 1;
+        for(size_t i=0; i<size; i++)
+            cells[i].sequence.store(i, std::memory_order_relaxed);
+    }
+
+    ~BoundedQueue() {
+        delete [] cells;
+    }
+
+    // moves item into the queue, FALSE if it is full
+    bool tryPush(T& item) {
+        size_t pos = enqueuePos.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell* cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            long diff = (long)sequence - (long)pos;
+            if(diff == 0) {
+                if(enqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    cell->data = std::move(item);
+                    cell->sequence.store(pos + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = enqueuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    // moves the oldest item out of the queue, FALSE if it is empty
+    bool tryPop(T* item) {
+        size_t pos = dequeuePos.load(std::memory_order_relaxed);
+        for(;;) {
+            Cell* cell = &cells[pos & mask];
+            size_t sequence = cell->sequence.load(std::memory_order_acquire);
+            long diff = (long)sequence - (long)(pos + 1);
+            if(diff == 0) {
+                if(dequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) {
+                    *item = std::move(cell->data);
+                    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+                    return true;
+                }
+            } else if(diff < 0) {
+                return false;
+            } else {
+                pos = dequeuePos.load(std::memory_order_relaxed);
+            }
+        }
+    }
+
+    void push(T& item) {
+        unsigned int spins = 0;
+        while(false == tryPush(item))
+            pause(&spins);
+    }
+
+    // FALSE once the queue is closed and empty
+    bool pop(T* item) {
+        unsigned int spins = 0;
+        for(;;) {
+            if(tryPop(item))
+                return true;
+
+            // a push may have happened between the failed pop and the close
+            if(closed.load(std::memory_order_acquire))
+                return tryPop(item);
+
+            pause(&spins);
+        }
+    }
+
+    // no more pushes will follow, call it once every producer is done
+    void close() {
+        closed.store(true, std::memory_order_release);
+    }
+
+    // a snapshot, exact only while nobody pushes or pops
+    size_t size() const {
+        size_t in = enqueuePos.load(std::memory_order_relaxed);
+        size_t out = dequeuePos.load(std::memory_order_relaxed);
+        return in > out ? in - out : 0;
+    }
+
+    size_t capacity() const {
+        return mask + 1;
+    }
+
+    static void pause(unsigned int* spins) {
+        if(*spins < 16) {
+            (*spins)++;
+            std::this_thread::yield();
+        } else {
+            std::this_thread::sleep_for(std::chrono::microseconds(100));
+        }
+    }
+
+private:
+    struct Cell
+    {
+        std::atomic<size_t> sequence;
+        T data;
+    };
+
+    Cell* cells;
+    size_t mask;
+
+    // producers and consumers each hammer their own counter, keep them on separate cache lines
+    alignas(64) std::atomic<size_t> enqueuePos;
+    alignas(64) std::atomic<size_t> dequeuePos;
+    alignas(64) std::atomic<bool> closed;
+
+    BoundedQueue(const BoundedQueue&);
+    BoundedQueue& operator=(const BoundedQueue&);
+};
+
+#endif // BOUNDEDQUEUE_H
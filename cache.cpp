@@ -19,20 +19,58 @@
  ***************************************************************************/
 
 #include "cache.h"
+#include "stats.h"
+#include "fuzzymatcher.h"
+#include "vCard/strutils.h"
+#include <set>
+#include <algorithm>
+#include <fcntl.h>
+#include <sys/file.h>
 
 Cache::Cache()
 {
-    cache_file = cfg.getCacheFile();
+    cache_file = Settings::getCacheFile();
     db = NULL;
+    searchStmt = NULL;
+    keepShadow = false;
+    shadowLock = -1;
+
+    compressCards = false;
+    stripBinary = false;
+}
+
+Cache::Cache(const std::string &cacheFile)
+{
+    cache_file = cacheFile;
+    db = NULL;
+    searchStmt = NULL;
+    keepShadow = false;
+    shadowLock = -1;
+
+    compressCards = false;
+    stripBinary = false;
 }
 
 Cache::~Cache() {
+    if(searchStmt)
+        sqlite3_finalize(searchStmt);
+    finalizeStatements();
+
     if (db) {
         int retVal = sqlite3_close(db);
         if( SQLITE_OK != retVal ) {
             std::cerr << "Oops: failed to properly close database: " << sqlite3_errmsg(db) << std::endl;
         }
     }
+
+    // a rebuild that was never committed leaves the old cache untouched
+    if(shadow_file.size() > 0 && false == keepShadow && FileUtils::fileExists(shadow_file)) {
+        FileUtils::fileRemove(shadow_file);
+        std::cerr << "Cache rebuild not completed, keeping the old cache" << std::endl;
+    }
+
+    if(shadowLock >= 0)
+        close(shadowLock);
 }
 
 void Cache::trace_cb(void* udp, const char* sql) {
@@ -60,6 +98,15 @@ bool Cache::stepSqlite(const std::string &errMsg) {
     return true;
 }
 
+// prepare, step and finalize a statement without parameters or results
+bool Cache::execSqlite(const std::string &query, const std::string &errMsg) {
+    bool b = prepSqlite(query);
+    if(false == b) return b;
+    b = stepSqlite(errMsg);
+    finalizeSqlite();
+    return b;
+}
+
 bool Cache::prepSqlite(const std::string &query) {
     int retVal = sqlite3_prepare_v2(db, query.c_str(), -1, &stmt, NULL);
     if(SQLITE_OK != retVal) {
@@ -70,62 +117,444 @@ bool Cache::prepSqlite(const std::string &query) {
     return true;
 }
 
-std::vector<Person> Cache::findInCache(const std::string &query) {
-    std::vector< Person > result;
+// returns the prepared statement for query, reset and with its bindings cleared
+sqlite3_stmt* Cache::statement(const std::string &query) {
+    std::map<std::string, sqlite3_stmt*>::iterator it = statements.find(query);
+    if(it != statements.end()) {
+        sqlite3_reset(it->second);
+        sqlite3_clear_bindings(it->second);
+        return it->second;
+    }
 
-    if(false == openDatabase())
-        return result;
+    sqlite3_stmt* s = NULL;
+    if(SQLITE_OK != sqlite3_prepare_v2(db, query.c_str(), -1, &s, NULL)) {
+        std::cerr << "Failed to prepare statement: " << query << ": " << sqlite3_errmsg(db) << std::endl;
+        return NULL;
+    }
+
+    statements[query] = s;
+    return s;
+}
+
+void Cache::finalizeStatements() {
+    for(std::map<std::string, sqlite3_stmt*>::iterator it = statements.begin(); it != statements.end(); ++it)
+        sqlite3_finalize(it->second);
+    statements.clear();
+}
+
+// Prepares searchStmt for the search and binds its parameters. The statement
+// is kept and only rebound as long as the sections stay the same, which
+// saves compiling it again for every query of a --batch run
+bool Cache::prepareSearch(const std::string &query, const std::vector<std::string> &sections) {
+    if(searchStmt && sections == searchSections) {
+        sqlite3_reset(searchStmt);
+        sqlite3_clear_bindings(searchStmt);
+    } else if(false == prepareSearchStatement(sections)) {
+        return false;
+    }
+
+    sqlite3_bind_text(searchStmt, 1, query.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(searchStmt, 2, query.c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_text(searchStmt, 3, query.c_str(), -1, SQLITE_TRANSIENT);
+
+    // once for IN (...) and once for the ordering
+    int param = 4;
+    for(int pass=0; pass<2; pass++) {
+        for(unsigned int i=0; i<sections.size(); i++) {
+            sqlite3_bind_text(searchStmt, param++, sections.at(i).c_str(), -1, SQLITE_TRANSIENT);
+        }
+    }
+
+    return true;
+}
+
+bool Cache::prepareSearchStatement(const std::vector<std::string> &sections) {
+    if(searchStmt) {
+        sqlite3_finalize(searchStmt);
+        searchStmt = NULL;
+    }
 
-    std::string _query = "SELECT v.firstname, v.lastname, e.mail FROM vcards v, emails e";
+    std::string _query = "SELECT v.firstname, v.lastname, e.mail, v.section FROM vcards v, emails e";
     _query += " WHERE e.vcardid = v.vcardid";
     _query += " AND (lower(v.firstname) LIKE '%' || lower(?) || '%'";
     _query += " OR lower(v.lastname) LIKE '%' || lower(?) || '%'";
     _query += " OR lower(e.mail) LIKE '%' || lower(?) || '%')";
 
-    
-    prepSqlite(_query);
+    if(sections.size() > 0) {
+        std::string placeholders;
+        std::string ordering;
+        for(unsigned int i=0; i<sections.size(); i++) {
+            std::stringstream ss;
+            ss << " WHEN ? THEN " << i;
+            ordering += ss.str();
+            placeholders += (i == 0) ? "?" : ", ?";
+        }
+        _query += " AND v.section IN (" + placeholders + ")";
+        _query += " ORDER BY CASE v.section" + ordering + " END";
+    }
 
-    sqlite3_bind_text(stmt, 1, query.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 2, query.c_str(), -1, SQLITE_TRANSIENT);
-    sqlite3_bind_text(stmt, 3, query.c_str(), -1, SQLITE_TRANSIENT);
+    if(SQLITE_OK != sqlite3_prepare_v2(db, _query.c_str(), -1, &searchStmt, NULL)) {
+        std::cerr << "Failed to prepare the search: " << sqlite3_errmsg(db) << std::endl;
+        searchStmt = NULL;
+        return false;
+    }
+
+    searchSections = sections;
+    return true;
+}
+
+// sections restricts the search to the cards of these config sections, results
+// are returned in the order the sections are given. The rows go straight from
+// sqlite into writer without building Persons first. Returns the number of rows found
+int Cache::writeFromCache(const std::string &query, const std::vector<std::string> &sections, ResultWriter *writer) {
+    StatsTimer timer("Cache::writeFromCache");
+
+    if(false == openDatabase())
+        return 0;
+
+    if(false == prepareSearch(query, sections))
+        return 0;
 
     if(Option::isVerbose()) {
         sqlite3_trace(db, &Cache::trace_cb, NULL);
     }
 
-    bool done = false;
-    while(!done) {
-        switch ( sqlite3_step( stmt ) ) {
-        case SQLITE_ROW:
-            {
-                //std::string fn((const wchar_t*)sqlite3_column_text(stmt, 0));
-                std::string fn    = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
-                std::string ln    = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1)));
-                std::string email = std::string(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2)));
+    int rows = 0;
+    int rc;
+    while((rc = sqlite3_step(searchStmt)) == SQLITE_ROW) {
+        const char* fn = reinterpret_cast<const char*>(sqlite3_column_text(searchStmt, 0));
+        const char* ln = reinterpret_cast<const char*>(sqlite3_column_text(searchStmt, 1));
+        const char* email = reinterpret_cast<const char*>(sqlite3_column_text(searchStmt, 2));
+
+        writer->add(email ? email : "", fn ? fn : "", ln ? ln : "");
+        rows++;
+    }
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to execute query: " << sqlite3_errmsg(db) << std::endl;
+
+    Stats::count("rows_scanned", sqlite3_stmt_status(searchStmt, SQLITE_STMTSTATUS_FULLSCAN_STEP, 1));
+    Stats::count("rows_returned", rows);
+
+    sqlite3_reset(searchStmt);
+    return rows;
+}
+
+// Terms of the index within the allowed edit distance of term, found by
+// their shared trigrams and verified with the real distance
+bool Cache::fuzzyTerms(const std::string &term, std::map<sqlite3_int64, int> *termDistances) {
+    std::vector<std::string> grams = FuzzyMatcher::grams(term);
+    int max = FuzzyMatcher::maxDistance(term);
+
+    std::string query = "SELECT t.TermID, t.Term FROM grams g, terms t WHERE t.TermID = g.TermID AND g.Gram IN (";
+    for(unsigned int i=0; i<grams.size(); i++)
+        query += (i == 0) ? "?" : ", ?";
+    query += ") AND t.Length BETWEEN ? AND ? GROUP BY g.TermID HAVING count(*) >= ?";
+
+    sqlite3_stmt* s = statement(query);
+    if(s == NULL)
+        return false;
+
+    int param = 1;
+    for(unsigned int i=0; i<grams.size(); i++)
+        sqlite3_bind_text(s, param++, grams.at(i).c_str(), -1, SQLITE_TRANSIENT);
+    sqlite3_bind_int(s, param++, (int)term.size() - max);
+    sqlite3_bind_int(s, param++, (int)term.size() + max);
+    sqlite3_bind_int(s, param++, FuzzyMatcher::minSharedGrams(term));
+
+    int candidates = 0;
+    while(sqlite3_step(s) == SQLITE_ROW) {
+        std::string candidate(reinterpret_cast<const char*>(sqlite3_column_text(s, 1)));
+        int d = FuzzyMatcher::distance(term, candidate, max);
+        candidates++;
+        if(d <= max) {
+            (*termDistances)[sqlite3_column_int64(s, 0)] = d;
+            if(Option::isVerbose())
+                std::cout << "Fuzzy match '" << term << "' ~ '" << candidate << "', distance " << d << std::endl;
+        }
+    }
+
+    Stats::count("fuzzy_candidates", candidates);
+    sqlite3_reset(s);
+    return true;
+}
+
+// The typo tolerant search, meant to run after writeFromCache found nothing.
+// Every term of the query must match a term of the card, i.e. its name or
+// the local part of an address, within a small edit distance. Cards with
+// fewer edits come first, then the order of sections, and at most limit
+// cards are written, all of them for limit <= 0. Returns the number of
+// rows found
+int Cache::writeFuzzyFromCache(const std::string &query, const std::vector<std::string> &sections, int limit, ResultWriter *writer) {
+    StatsTimer timer("Cache::writeFuzzyFromCache");
+
+    std::vector<std::string> queryTerms = FuzzyMatcher::terms(query);
+    if(queryTerms.size() == 0)
+        return 0;
+
+    if(false == openDatabase())
+        return 0;
+
+    sqlite3_stmt* termCards = statement("SELECT VCardID FROM term_cards WHERE TermID = ?");
+    if(termCards == NULL)
+        return 0;
+
+    // a single term's edits are its distance and the terms are walked closest
+    // first, so once limit cards matched no card found later ranks higher.
+    // Sections may still filter cards out, then every term is looked at
+    bool stopEarly = limit > 0 && queryTerms.size() == 1 && sections.size() == 0;
+
+    // edits per card, summed over the query terms
+    std::map<sqlite3_int64, int> cards;
+
+    for(unsigned int i=0; i<queryTerms.size(); i++) {
+        std::map<sqlite3_int64, int> termDistances;
+        if(false == fuzzyTerms(queryTerms.at(i), &termDistances) || termDistances.size() == 0)
+            return 0;
+
+        // closest terms first
+        std::vector< std::pair<int, sqlite3_int64> > byDistance;
+        for(std::map<sqlite3_int64, int>::const_iterator t = termDistances.begin(); t != termDistances.end(); ++t)
+            byDistance.push_back(std::make_pair(t->second, t->first));
+        std::sort(byDistance.begin(), byDistance.end());
+
+        std::map<sqlite3_int64, int> matched;
+        for(unsigned int t=0; t<byDistance.size(); t++) {
+            int distance = byDistance.at(t).first;
+            if(stopEarly && (int)matched.size() >= limit)
+                break;
+
+            sqlite3_reset(termCards);
+            sqlite3_bind_int64(termCards, 1, byDistance.at(t).second);
+            while((false == stopEarly || (int)matched.size() < limit) && sqlite3_step(termCards) == SQLITE_ROW) {
+                sqlite3_int64 card = sqlite3_column_int64(termCards, 0);
+                if(i > 0 && cards.count(card) == 0)
+                    continue;
+
+                std::map<sqlite3_int64, int>::iterator m = matched.find(card);
+                if(m == matched.end() || m->second > distance)
+                    matched[card] = distance;
+            }
+        }
+
+        if(i > 0) {
+            for(std::map<sqlite3_int64, int>::iterator m = matched.begin(); m != matched.end(); ++m)
+                m->second += cards[m->first];
+        }
+
+        cards.swap(matched);
+        if(cards.size() == 0)
+            return 0;
+    }
+
+    // the cards by edits, the rows of those with the same edits are then
+    // ordered by section. Only the rows that are written are read
+    std::vector< std::pair<int, sqlite3_int64> > ranked;
+    for(std::map<sqlite3_int64, int>::const_iterator c = cards.begin(); c != cards.end(); ++c)
+        ranked.push_back(std::make_pair(c->second, c->first));
+    std::sort(ranked.begin(), ranked.end());
 
-                Person p;
-                p.LastName = ln;
-                p.FirstName = fn;
-                p.Emails.push_back(email);
+    struct Row {
+        int sectionOrder;
+        sqlite3_int64 card;
+        std::string email, fn, ln;
+        bool operator<(const Row& other) const {
+            return sectionOrder < other.sectionOrder;
+        }
+    };
+
+    sqlite3_stmt* rows = statement("SELECT v.firstname, v.lastname, e.mail, v.section FROM vcards v, emails e"
+                                   " WHERE v.VCardID = ? AND e.VCardID = v.VCardID");
+    if(rows == NULL)
+        return 0;
+
+    int written = 0;
+    int numCards = 0;
+    for(size_t begin = 0; begin < ranked.size() && (limit <= 0 || numCards < limit); ) {
+        size_t end = begin;
+        while(end < ranked.size() && ranked.at(end).first == ranked.at(begin).first)
+            end++;
+
+        // without sections to order by the group is written as it is read,
+        // so reading stops with the last card that fits
+        std::vector<Row> group;
+        int groupCards = 0;
+        for(size_t c = begin; c < end; c++) {
+            if(sections.size() == 0 && limit > 0 && numCards + groupCards >= limit)
+                break;
 
-                if(Option::isVerbose()) {
-                    std::cout << "Found person in cache: " << p.LastName << ":" << p.FirstName << ":" << email << std::endl;
+            size_t before = group.size();
+            sqlite3_reset(rows);
+            sqlite3_bind_int64(rows, 1, ranked.at(c).second);
+            while(sqlite3_step(rows) == SQLITE_ROW) {
+                const char* section = reinterpret_cast<const char*>(sqlite3_column_text(rows, 3));
+                int sectionOrder = 0;
+                if(sections.size() > 0) {
+                    std::vector<std::string>::const_iterator it = std::find(sections.begin(), sections.end(), section ? section : "");
+                    if(it == sections.end())
+                        break;
+                    sectionOrder = it - sections.begin();
                 }
 
-                result.push_back(p);
+                const char* email = reinterpret_cast<const char*>(sqlite3_column_text(rows, 2));
+                Row r;
+                r.sectionOrder = sectionOrder;
+                r.card = ranked.at(c).second;
+                r.email = email ? email : "";
+                r.fn = reinterpret_cast<const char*>(sqlite3_column_text(rows, 0));
+                r.ln = reinterpret_cast<const char*>(sqlite3_column_text(rows, 1));
+                group.push_back(r);
+            }
+
+            if(group.size() > before)
+                groupCards++;
+        }
+
+        // the rows of a card share its section and stay together
+        std::stable_sort(group.begin(), group.end());
+        for(unsigned int r=0; r<group.size(); r++) {
+            if(r == 0 || group.at(r).card != group.at(r - 1).card) {
+                if(limit > 0 && numCards >= limit)
+                    break;
+                numCards++;
             }
-            break;
-        case SQLITE_DONE:
-            done = true;
-            break;
-        default:
-            throw("Unable to execute query");
-            break;
+            writer->add(group.at(r).email.c_str(), group.at(r).fn.c_str(), group.at(r).ln.c_str());
+            written++;
         }
+
+        begin = end;
+    }
+
+    Stats::count("rows_returned", written);
+    return written;
+}
+
+// the smallest string greater than every string starting with prefix
+static std::string prefixEnd(const std::string& prefix) {
+    std::string end = prefix;
+    while(end.size() > 0 && (unsigned char)end[end.size() - 1] == 0xFF)
+        end.erase(end.size() - 1);
+    if(end.size() > 0)
+        end[end.size() - 1]++;
+    return end;
+}
+
+// Completions for a partially typed name or address, as mutt's
+// complete-query asks for them. Addresses starting with prefix come first,
+// then cards with a name or address term starting with it. Both lookups
+// are range scans over an index, walked in order until limit distinct
+// addresses were written, so the cost does not depend on the size of the
+// cache. Of several words only the last one is a prefix, the cards must
+// have the others as terms ("john smi"). Returns the number of addresses
+// written
+int Cache::writeCompletions(const std::string &prefix, const std::vector<std::string> &sections, int limit, ResultWriter *writer) {
+    StatsTimer timer("Cache::writeCompletions");
+
+    std::string trimmed = prefix;
+    trimmed = StrUtils::trim(trimmed);
+
+    std::vector<std::string> required;
+    size_t space = trimmed.find_last_of(" \t");
+    if(space != std::string::npos) {
+        required = FuzzyMatcher::terms(trimmed.substr(0, space));
+        trimmed = trimmed.substr(space + 1);
+    }
+
+    std::string address;
+    for(size_t i=0; i<trimmed.size(); i++)
+        address += tolower((unsigned char)trimmed[i]);
+
+    std::string term = FuzzyMatcher::fold(trimmed);
+    if(address.size() == 0 || term.size() == 0)
+        return 0;
+
+    if(false == openDatabase())
+        return 0;
+
+    std::string filter;
+    for(unsigned int i=0; i<required.size(); i++)
+        filter += " AND EXISTS (SELECT 1 FROM terms rt, term_cards rtc WHERE rt.Term = ? AND rtc.TermID = rt.TermID AND rtc.VCardID = v.VCardID)";
+    for(unsigned int i=0; i<sections.size(); i++)
+        filter += (i == 0) ? " AND v.section IN (?" : ", ?";
+    if(sections.size() > 0)
+        filter += ")";
+
+    int written = writeRange("SELECT v.firstname, v.lastname, e.mail FROM emails e, vcards v"
+                             " WHERE lower(e.mail) >= ? AND lower(e.mail) < ? AND v.VCardID = e.VCardID" + filter +
+                             " ORDER BY lower(e.mail)", address, required, sections, limit, writer);
+
+    if(written < limit || limit <= 0) {
+        written += writeRange("SELECT v.firstname, v.lastname, e.mail FROM terms t, term_cards tc, vcards v, emails e"
+                              " WHERE t.Term >= ? AND t.Term < ? AND tc.TermID = t.TermID AND v.VCardID = tc.VCardID"
+                              " AND e.VCardID = v.VCardID" + filter +
+                              " ORDER BY t.Term", term, required, sections, limit > 0 ? limit - written : 0, writer);
+    }
+
+    Stats::count("rows_returned", written);
+    return written;
+}
+
+// writes the rows of query for the range [from, prefixEnd(from)) until
+// limit new addresses were written, no limit if limit <= 0. The terms in
+// required and then the sections are bound to the parameters after the range
+int Cache::writeRange(const std::string &query, const std::string &from, const std::vector<std::string> &required, const std::vector<std::string> &sections, int limit, ResultWriter *writer) {
+    sqlite3_stmt* s = statement(query);
+    if(s == NULL)
+        return 0;
+
+    std::string to = prefixEnd(from);
+    sqlite3_bind_text(s, 1, from.c_str(), from.size(), SQLITE_TRANSIENT);
+    if(to.size() > 0)
+        sqlite3_bind_text(s, 2, to.c_str(), to.size(), SQLITE_TRANSIENT);
+    else
+        sqlite3_bind_blob(s, 2, "\xff", 1, SQLITE_STATIC);
+    int param = 3;
+    for(unsigned int i=0; i<required.size(); i++)
+        sqlite3_bind_text(s, param++, required.at(i).c_str(), -1, SQLITE_TRANSIENT);
+    for(unsigned int i=0; i<sections.size(); i++)
+        sqlite3_bind_text(s, param++, sections.at(i).c_str(), -1, SQLITE_TRANSIENT);
+
+    int written = 0;
+    while((limit <= 0 || written < limit) && sqlite3_step(s) == SQLITE_ROW) {
+        const char* fn = reinterpret_cast<const char*>(sqlite3_column_text(s, 0));
+        const char* ln = reinterpret_cast<const char*>(sqlite3_column_text(s, 1));
+        const char* email = reinterpret_cast<const char*>(sqlite3_column_text(s, 2));
+
+        if(writer->add(email ? email : "", fn ? fn : "", ln ? ln : ""))
+            written++;
     }
 
+    sqlite3_reset(s);
+    return written;
+}
+
+// every address in the cache as a Person of its own, for the exports
+bool Cache::allEntries(std::vector<Person> *people) {
+    if(false == openDatabase())
+        return false;
+
+    // a fixed order, so the same cache always keeps the same name for an address
+    if(false == prepSqlite("SELECT v.firstname, v.lastname, e.mail FROM vcards v, emails e WHERE e.vcardid = v.vcardid ORDER BY e.mail, v.vcardid"))
+        return false;
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* fn = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        const char* ln = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        const char* email = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+
+        Person p;
+        p.FirstName = fn ? fn : "";
+        p.LastName = ln ? ln : "";
+        p.Emails.push_back(email ? email : "");
+        people->push_back(p);
+    }
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to read the cache: " << sqlite3_errmsg(db) << std::endl;
+
     finalizeSqlite();
-    return result;
+    return rc == SQLITE_DONE;
 }
 
 std::string Cache::buildDateTimeString(const std::string &dtString) {
@@ -168,6 +597,8 @@ bool Cache::openDatabase() {
     // allready open?
     if(db) return true;
 
+    StatsTimer timer("Cache::openDatabase");
+
     if(false == initSqlite())
         return false;
 
@@ -177,6 +608,150 @@ bool Cache::openDatabase() {
         return false;
     }
 
+    // another instance may be writing back online results right now
+    sqlite3_busy_timeout(db, SQLITE_BUSY_TIMEOUT_MS);
+
+    if(false == checkSchemaVersion()) {
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    loadStorageOptions();
+    return true;
+}
+
+// caches written by an older version lack columns we rely on
+bool Cache::checkSchemaVersion() {
+    int version = 0;
+    if(prepSqlite("PRAGMA user_version")) {
+        if(sqlite3_step(stmt) == SQLITE_ROW)
+            version = sqlite3_column_int(stmt, 0);
+        finalizeSqlite();
+    }
+
+    if(version != CACHE_SCHEMA_VERSION) {
+        std::cerr << "Cache database '" << cache_file << "' has an outdated format, please run --create-local-cache" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+bool Cache::setMeta(const std::string &key, const std::string &value) {
+    bool b = prepSqlite("INSERT OR REPLACE INTO meta (Key, Value) VALUES (?, ?)");
+    if(false == b) return b;
+
+    sqlite3_bind_text(stmt, 1, key.c_str(), key.length(), NULL);
+    sqlite3_bind_blob(stmt, 2, value.data(), value.size(), NULL);
+    b = stepSqlite("Failed to store '" + key + "' in cache database");
+    finalizeSqlite();
+    return b;
+}
+
+bool Cache::getMeta(const std::string &key, std::string *value) {
+    if(false == prepSqlite("SELECT Value FROM meta WHERE Key = ?"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, key.c_str(), key.length(), NULL);
+
+    bool found = false;
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* blob = reinterpret_cast<const char*>(sqlite3_column_blob(stmt, 0));
+        value->assign(blob ? blob : "", sqlite3_column_bytes(stmt, 0));
+        found = true;
+    }
+
+    finalizeSqlite();
+    return found;
+}
+
+// online results written back to the cache follow the options the cache was created with
+void Cache::loadStorageOptions() {
+    std::string value;
+    compressCards = getMeta("compress", &value) && value == "1";
+    stripBinary = getMeta("strip", &value) && value == "1";
+
+    if(compressCards)
+        getMeta("dictionary", &dictionary);
+}
+
+bool Cache::setStorageOptions(bool compress, bool strip) {
+    compressCards = compress;
+    stripBinary = strip;
+
+    if(false == setMeta("compress", compress ? "1" : "0"))
+        return false;
+
+    return setMeta("strip", strip ? "1" : "0");
+}
+
+// builds the zlib preset dictionary from the cards about to be imported.
+// Without samples there is nothing to learn from, the next batch trains it
+bool Cache::trainDictionary(const std::vector<std::string> &samples) {
+    // a dictionary taken over from the previous cache stays, its cards depend on it
+    if(false == compressCards || dictionary.size() > 0 || samples.size() == 0)
+        return true;
+
+    // so do cards compressed before, even without a dictionary
+    sqlite3_stmt* s = statement("SELECT 1 FROM vcards WHERE Compressed = 1 LIMIT 1");
+    if(s == NULL)
+        return false;
+    bool compressed = sqlite3_step(s) == SQLITE_ROW;
+    sqlite3_reset(s);
+    if(compressed)
+        return true;
+
+    if(stripBinary) {
+        std::vector<std::string> stripped;
+        for(unsigned int i=0; i<samples.size(); i++)
+            stripped.push_back(CardCompressor::stripBinary(samples.at(i)));
+        dictionary = CardCompressor::trainDictionary(stripped);
+    } else {
+        dictionary = CardCompressor::trainDictionary(samples);
+    }
+
+    if(Option::isVerbose()) {
+        std::cout << "Trained compression dictionary of " << dictionary.size() << " bytes" << std::endl;
+    }
+
+    return setMeta("dictionary", dictionary);
+}
+
+// the raw vcard is never needed for searching, so it is only decompressed on demand
+bool Cache::getVCardData(sqlite3_int64 vcardId, std::string *data) {
+    if(false == openDatabase())
+        return false;
+
+    if(false == prepSqlite("SELECT VCard, Compressed FROM vcards WHERE VCardID = ?"))
+        return false;
+
+    sqlite3_bind_int64(stmt, 1, vcardId);
+
+    bool found = false;
+    std::string stored;
+    bool compressed = false;
+    if(sqlite3_step(stmt) == SQLITE_ROW) {
+        const char* blob = reinterpret_cast<const char*>(sqlite3_column_blob(stmt, 0));
+        stored.assign(blob ? blob : "", sqlite3_column_bytes(stmt, 0));
+        compressed = sqlite3_column_int(stmt, 1) == 1;
+        found = true;
+    }
+    finalizeSqlite();
+
+    if(false == found)
+        return false;
+
+    if(false == compressed) {
+        *data = stored;
+        return true;
+    }
+
+    if(false == CardCompressor::decompress(stored, dictionary, data)) {
+        std::cerr << "Failed to decompress vcard " << vcardId << " from cache" << std::endl;
+        return false;
+    }
+
     return true;
 }
 
@@ -184,16 +759,74 @@ void Cache::addEmails(const std::vector<std::string> &emails, int rowID) {
     for(unsigned int i=0; i<emails.size(); i++) {
         std::string email = emails.at(i);
 
-        prepSqlite("INSERT INTO emails (vcardid, mail) VALUES(?, ?)");
-        // bind values
-        sqlite3_bind_int(stmt, 1, rowID);
-        sqlite3_bind_text(stmt, 2, email.c_str(), email.length(), NULL);
-        stepSqlite("Failed to add email to database");
-        finalizeSqlite();
+        sqlite3_stmt* s = statement("INSERT INTO emails (vcardid, mail) VALUES(?, ?)");
+        if(s == NULL)
+            return;
+
+        sqlite3_bind_int(s, 1, rowID);
+        sqlite3_bind_text(s, 2, email.c_str(), email.length(), NULL);
+        if(sqlite3_step(s) != SQLITE_DONE)
+            std::cerr << "Failed to add email to database: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_reset(s);
     }
 }
 
-void Cache::addVCard(const std::string &fn, const std::string &ln, const std::vector< std::string > &emails, const std::string &data, const std::string &updatedAt) {
+// adds the card to the index of the fuzzy search, new terms get their trigrams
+void Cache::addTerms(const std::string &fn, const std::string &ln, const std::vector<std::string> &emails, sqlite3_int64 rowID) {
+    std::vector<std::string> terms = FuzzyMatcher::cardTerms(fn, ln, emails);
+
+    sqlite3_stmt* insertTerm = statement("INSERT OR IGNORE INTO terms (Term, Length) VALUES (?, ?)");
+    sqlite3_stmt* selectTerm = statement("SELECT TermID FROM terms WHERE Term = ?");
+    sqlite3_stmt* insertGram = statement("INSERT OR IGNORE INTO grams (Gram, TermID) VALUES (?, ?)");
+    sqlite3_stmt* insertCard = statement("INSERT OR IGNORE INTO term_cards (TermID, VCardID) VALUES (?, ?)");
+    if(!insertTerm || !selectTerm || !insertGram || !insertCard)
+        return;
+
+    for(unsigned int i=0; i<terms.size(); i++) {
+        const std::string& term = terms.at(i);
+        sqlite3_int64 termID;
+
+        sqlite3_reset(insertTerm);
+        sqlite3_bind_text(insertTerm, 1, term.c_str(), term.size(), SQLITE_TRANSIENT);
+        sqlite3_bind_int(insertTerm, 2, term.size());
+        if(sqlite3_step(insertTerm) != SQLITE_DONE) {
+            std::cerr << "Failed to add term to cache database: " << sqlite3_errmsg(db) << std::endl;
+            return;
+        }
+
+        if(sqlite3_changes(db) > 0) {
+            termID = sqlite3_last_insert_rowid(db);
+
+            std::vector<std::string> grams = FuzzyMatcher::grams(term);
+            for(unsigned int j=0; j<grams.size(); j++) {
+                sqlite3_reset(insertGram);
+                sqlite3_bind_text(insertGram, 1, grams.at(j).c_str(), grams.at(j).size(), SQLITE_TRANSIENT);
+                sqlite3_bind_int64(insertGram, 2, termID);
+                sqlite3_step(insertGram);
+            }
+        } else {
+            sqlite3_reset(selectTerm);
+            sqlite3_bind_text(selectTerm, 1, term.c_str(), term.size(), SQLITE_TRANSIENT);
+            if(sqlite3_step(selectTerm) != SQLITE_ROW)
+                continue;
+            termID = sqlite3_column_int64(selectTerm, 0);
+        }
+
+        sqlite3_reset(insertCard);
+        sqlite3_bind_int64(insertCard, 1, termID);
+        sqlite3_bind_int64(insertCard, 2, rowID);
+        if(sqlite3_step(insertCard) != SQLITE_DONE)
+            std::cerr << "Failed to index term of vcard " << rowID << ": " << sqlite3_errmsg(db) << std::endl;
+    }
+
+    // a statement left in the middle of a read would keep the transaction open
+    sqlite3_reset(insertTerm);
+    sqlite3_reset(selectTerm);
+    sqlite3_reset(insertGram);
+    sqlite3_reset(insertCard);
+}
+
+void Cache::addVCard(const std::string &fn, const std::string &ln, const std::vector< std::string > &emails, const std::string &data, const std::string &updatedAt, const std::string &section, sqlite3_int64 fileId, const std::string &href, const std::string &etag, const std::string &lastModified) {
     if(fn.length() == 0) {
         std::cerr << "Firstname is empty!" << std::endl;
         return;
@@ -220,30 +853,74 @@ void Cache::addVCard(const std::string &fn, const std::string &ln, const std::ve
     }
 
     std::string dt = buildDateTimeString(updatedAt);
-    bool b = prepSqlite("INSERT INTO vcards (FirstName, LastName, VCard, UpdatedAt) VALUES (?, ?, ?, ?)");
-    if(b) {
-        sqlite3_bind_text(stmt, 1, fn.c_str(), fn.length(), NULL);
-        sqlite3_bind_text(stmt, 2, ln.c_str(), ln.length(), NULL);
-        sqlite3_bind_text(stmt, 3, data.c_str(), data.length(), NULL);
-        sqlite3_bind_text(stmt, 4, dt.c_str(), dt.length(), NULL);
-        b = stepSqlite("Failed to add new record to cache database");
-        if(b) {
-            finalizeSqlite();
-            sqlite3_int64 rowid = sqlite3_last_insert_rowid(db);
-            addEmails(emails, rowid);
+
+    std::string stored = stripBinary ? CardCompressor::stripBinary(data) : data;
+    bool compressed = false;
+    if(compressCards) {
+        std::string deflated;
+        if(CardCompressor::compress(stored, dictionary, &deflated)) {
+            stored = deflated;
+            compressed = true;
+        } else {
+            std::cerr << "Failed to compress vcard, storing it uncompressed" << std::endl;
         }
     }
+
+    insertCard(fn, ln, emails, stored, compressed, dt, section, fileId, href, etag, lastModified);
+}
+
+// stores a card as it is, already stripped and compressed if the storage options say so
+bool Cache::insertCard(const std::string &fn, const std::string &ln, const std::vector<std::string> &emails, const std::string &stored, bool compressed, const std::string &updatedAt, const std::string &section, sqlite3_int64 fileId, const std::string &href, const std::string &etag, const std::string &lastModified) {
+    sqlite3_stmt* s = statement("INSERT INTO vcards (FirstName, LastName, VCard, Compressed, UpdatedAt, Section, FileID, Href, ETag, LastModified) VALUES (?, ?, ?, ?, ?, ?, ?, ?, ?, ?)");
+    if(s == NULL)
+        return false;
+
+    sqlite3_bind_text(s, 1, fn.c_str(), fn.length(), NULL);
+    sqlite3_bind_text(s, 2, ln.c_str(), ln.length(), NULL);
+    if(compressed)
+        sqlite3_bind_blob(s, 3, stored.data(), stored.size(), NULL);
+    else
+        sqlite3_bind_text(s, 3, stored.c_str(), stored.length(), NULL);
+    sqlite3_bind_int(s, 4, compressed ? 1 : 0);
+    sqlite3_bind_text(s, 5, updatedAt.c_str(), updatedAt.length(), NULL);
+    sqlite3_bind_text(s, 6, section.c_str(), section.length(), NULL);
+    if(fileId > 0)
+        sqlite3_bind_int64(s, 7, fileId);
+    else
+        sqlite3_bind_null(s, 7);
+
+    const std::string* optional[] = { &href, &etag, &lastModified };
+    for(int i=0; i<3; i++) {
+        if(optional[i]->size() > 0)
+            sqlite3_bind_text(s, 8 + i, optional[i]->c_str(), optional[i]->length(), NULL);
+        else
+            sqlite3_bind_null(s, 8 + i);
+    }
+
+    bool b = sqlite3_step(s) == SQLITE_DONE;
+    sqlite3_reset(s);
+    if(false == b) {
+        std::cerr << "Failed to add new record to cache database: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    sqlite3_int64 rowid = sqlite3_last_insert_rowid(db);
+    addEmails(emails, rowid);
+    addTerms(fn, ln, emails, rowid);
+    return true;
 }
 
+// The new cache is written to a shadow file next to the real one. Searches keep
+// using the old cache until commitDatabase() renames the shadow file over it.
 bool Cache::createDatabase() {
+    shadow_file = cache_file + ".tmp";
+    if(false == lockShadow())
+        return false;
 
-    // test if file exists
-    if(FileUtils::fileExists(cache_file)) {
-        // stdio standard function
-        if( FileUtils::fileRemove(cache_file) ) {
-            std::cout << "Old cache database removed" << std::endl;
-        } else {
-            std::cerr << "Failed to remove old cache database '" << cache_file << "'" << std::endl;
+    // leftover of an aborted rebuild
+    if(FileUtils::fileExists(shadow_file)) {
+        if( false == FileUtils::fileRemove(shadow_file) ) {
+            std::cerr << "Failed to remove stale cache database '" << shadow_file << "'" << std::endl;
             return false;
         }
     }
@@ -251,14 +928,14 @@ bool Cache::createDatabase() {
     if(false == initSqlite())
         return false;
 
-    int retVal = sqlite3_open_v2(cache_file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    int retVal = sqlite3_open_v2(shadow_file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
     if(SQLITE_OK != retVal) {
-        std::cerr << "Can't open/create database in " << cache_file << ": " << sqlite3_errmsg(db) << std::endl;
+        std::cerr << "Can't open/create database in " << shadow_file << ": " << sqlite3_errmsg(db) << std::endl;
         return false;
     }
 
     // create the main table
-    bool b = prepSqlite("CREATE TABLE vcards(VCardID INTEGER PRIMARY KEY, FirstName STRING, LastName STRING, VCard TEXT, UpdatedAt STRING)");
+    bool b = prepSqlite("CREATE TABLE vcards(VCardID INTEGER PRIMARY KEY, FirstName STRING, LastName STRING, VCard BLOB, Compressed INTEGER, UpdatedAt STRING, Section STRING, FileID INTEGER, Href TEXT, ETag TEXT, LastModified TEXT)");
     if(false == b) return b;
     b = stepSqlite("Can't step to create table 'vcards' in cache database");
     if(false == b) return b;
@@ -273,12 +950,12 @@ bool Cache::createDatabase() {
     b = finalizeSqlite();
     if(false == b) return b;
 
-    // index on raw vcard data
-    b = prepSqlite("CREATE INDEX vcard_idx ON vcards (vcard)");
+    // index on the config section a card came from
+    b = execSqlite("CREATE INDEX section_idx ON vcards (section)", "Can't step on index for table 'vcards', column 'section'");
     if(false == b) return b;
-    b = stepSqlite("Can't step on index for table 'vcards', column 'vcard'");
-    if(false == b) return b;
-    b = finalizeSqlite();
+
+    // storage options and the compression dictionary
+    b = execSqlite("CREATE TABLE meta(Key STRING PRIMARY KEY, Value BLOB)", "Can't step to create table 'meta' in cache database");
     if(false == b) return b;
 
     // index on email data
@@ -289,6 +966,14 @@ bool Cache::createDatabase() {
     b = finalizeSqlite();
     if(false == b) return b;
 
+    // completions of partially typed addresses
+    b = execSqlite("CREATE INDEX email_lower_idx ON emails (lower(mail))", "Can't step on index for table 'emails', column 'lower(mail)'");
+    if(false == b) return b;
+
+    // the fuzzy search reaches the addresses from the card
+    b = execSqlite("CREATE INDEX email_vcard_idx ON emails (vcardid)", "Can't step on index for table 'emails', column 'vcardid'");
+    if(false == b) return b;
+
     // index on first name
     b = prepSqlite("CREATE INDEX firstname_idx ON vcards (firstname)");
     if(false == b) return b;
@@ -313,6 +998,486 @@ bool Cache::createDatabase() {
     b = finalizeSqlite();
     if(false == b) return b;
 
-    std::cout << "New cache database created in '" << cache_file << "'" << std::endl;
+    // the files of local sections and the cards read from them
+    b = execSqlite("CREATE TABLE files(FileID INTEGER PRIMARY KEY, Path TEXT UNIQUE, Section TEXT, MTime INTEGER, Size INTEGER)", "Can't step to create table 'files' in cache database");
+    if(false == b) return b;
+    b = execSqlite("CREATE INDEX file_idx ON vcards (fileid)", "Can't step on index for table 'vcards', column 'fileid'");
+    if(false == b) return b;
+
+    // the next sync finds a card by its href to revalidate it
+    b = execSqlite("CREATE INDEX href_idx ON vcards (href)", "Can't step on index for table 'vcards', column 'href'");
+    if(false == b) return b;
+
+    // the fuzzy search index: the terms of names and addresses, the cards
+    // they appear in and their trigrams
+    b = execSqlite("CREATE TABLE terms(TermID INTEGER PRIMARY KEY, Term TEXT UNIQUE, Length INTEGER)", "Can't step to create table 'terms' in cache database");
+    if(false == b) return b;
+    b = execSqlite("CREATE TABLE term_cards(TermID INTEGER, VCardID INTEGER, PRIMARY KEY (TermID, VCardID)) WITHOUT ROWID", "Can't step to create table 'term_cards' in cache database");
+    if(false == b) return b;
+    b = execSqlite("CREATE TABLE grams(Gram TEXT, TermID INTEGER, PRIMARY KEY (Gram, TermID)) WITHOUT ROWID", "Can't step to create table 'grams' in cache database");
+    if(false == b) return b;
+
+    // the sections a full sync is done with, --resume continues with the others
+    b = execSqlite("CREATE TABLE sync_progress(Section TEXT PRIMARY KEY, Complete INTEGER)", "Can't step to create table 'sync_progress' in cache database");
+    if(false == b) return b;
+
+    // a collection whose ctag did not change since the last sync holds the same cards
+    b = execSqlite("CREATE TABLE collections(Section TEXT PRIMARY KEY, Url TEXT, CTag TEXT)", "Can't step to create table 'collections' in cache database");
+    if(false == b) return b;
+
+    std::stringstream version;
+    version << "PRAGMA user_version = " << CACHE_SCHEMA_VERSION;
+    b = execSqlite(version.str(), "Can't set schema version of cache database");
+    if(false == b) return b;
+
     return b;
 }
+
+bool Cache::beginTransaction() {
+    if(false == openDatabase())
+        return false;
+
+    return execSqlite("BEGIN TRANSACTION", "Can't begin transaction on cache database");
+}
+
+bool Cache::commitTransaction() {
+    return execSqlite("COMMIT TRANSACTION", "Can't commit transaction on cache database");
+}
+
+void Cache::rollbackTransaction() {
+    execSqlite("ROLLBACK TRANSACTION", "Can't roll back transaction on cache database");
+}
+
+// the cards of a config section by href, used to refresh the section in place.
+// Cards without an href are listed under an empty one
+bool Cache::getSectionCards(const std::string &section, std::multimap<std::string, sqlite3_int64> *cards) {
+    if(false == prepSqlite("SELECT VCardID, Href FROM vcards WHERE Section = ?"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, section.c_str(), section.length(), SQLITE_TRANSIENT);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        const char* href = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        cards->insert(std::make_pair(std::string(href ? href : ""), sqlite3_column_int64(stmt, 0)));
+    }
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to read the cards of section '" << section << "': " << sqlite3_errmsg(db) << std::endl;
+
+    finalizeSqlite();
+    return rc == SQLITE_DONE;
+}
+
+// terms no card uses anymore stay, they only cost a lookup that finds no cards
+bool Cache::removeCard(sqlite3_int64 id) {
+    const char* queries[] = {
+        "DELETE FROM emails WHERE VCardID = ?",
+        "DELETE FROM term_cards WHERE VCardID = ?",
+        "DELETE FROM vcards WHERE VCardID = ?"
+    };
+
+    for(int i=0; i<3; i++) {
+        sqlite3_stmt* s = statement(queries[i]);
+        if(s == NULL)
+            return false;
+
+        sqlite3_bind_int64(s, 1, id);
+        int rc = sqlite3_step(s);
+        sqlite3_reset(s);
+        if(rc != SQLITE_DONE) {
+            std::cerr << "Failed to remove card " << id << " from cache: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+bool Cache::getFiles(const std::string &section, std::map<std::string, CachedFile> *files) {
+    if(false == openDatabase())
+        return false;
+
+    if(false == prepSqlite("SELECT FileID, Path, MTime, Size FROM files WHERE Section = ?"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, section.c_str(), section.length(), SQLITE_TRANSIENT);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        CachedFile f;
+        f.id = sqlite3_column_int64(stmt, 0);
+        f.mtime = sqlite3_column_int64(stmt, 2);
+        f.size = sqlite3_column_int64(stmt, 3);
+        (*files)[reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1))] = f;
+    }
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to read the imported files: " << sqlite3_errmsg(db) << std::endl;
+
+    finalizeSqlite();
+    return rc == SQLITE_DONE;
+}
+
+// Makes the cache a full sync replaces available for revalidating its cards.
+// Its cards can only be copied if they were stored the same way, the new
+// cache then compresses with the dictionary of the old one. Run it outside
+// of a transaction
+bool Cache::attachPrevious(const std::string &file) {
+    if(db == NULL || false == FileUtils::fileExists(file))
+        return false;
+
+    if(false == prepSqlite("ATTACH DATABASE ? AS previous"))
+        return false;
+    sqlite3_bind_text(stmt, 1, file.c_str(), file.length(), SQLITE_TRANSIENT);
+    bool b = stepSqlite("Can't attach the previous cache database");
+    finalizeSqlite();
+    if(false == b)
+        return false;
+
+    int version = 0;
+    if(prepSqlite("PRAGMA previous.user_version")) {
+        if(sqlite3_step(stmt) == SQLITE_ROW)
+            version = sqlite3_column_int(stmt, 0);
+        finalizeSqlite();
+    }
+
+    std::map<std::string, std::string> meta;
+    if(version == CACHE_SCHEMA_VERSION && prepSqlite("SELECT Key, Value FROM previous.meta")) {
+        while(sqlite3_step(stmt) == SQLITE_ROW) {
+            const char* value = reinterpret_cast<const char*>(sqlite3_column_blob(stmt, 1));
+            meta[reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))].assign(value ? value : "", sqlite3_column_bytes(stmt, 1));
+        }
+        finalizeSqlite();
+    }
+
+    bool compatible = version == CACHE_SCHEMA_VERSION
+            && (meta["compress"] == "1") == compressCards
+            && (meta["strip"] == "1") == stripBinary
+            && (false == compressCards || dictionary.size() == 0 || dictionary == meta["dictionary"]);
+
+    if(false == compatible) {
+        if(Option::isVerbose())
+            std::cout << "The previous cache was built differently, all cards are downloaded again" << std::endl;
+        execSqlite("DETACH DATABASE previous", "Can't detach the previous cache database");
+        return false;
+    }
+
+    if(compressCards && dictionary.size() == 0) {
+        dictionary = meta["dictionary"];
+        if(false == setMeta("dictionary", dictionary))
+            return false;
+    }
+
+    return true;
+}
+
+// the validators of the cards this or the previous cache holds for section, by
+// href. Cards the server sent without ETag or Last-Modified come with empty ones
+bool Cache::getValidators(const std::string &section, bool previous, std::map<std::string, CardValidators> *validators) {
+    if(false == prepSqlite(previous ? "SELECT Href, ETag, LastModified FROM previous.vcards WHERE Section = ? AND Href IS NOT NULL"
+                                    : "SELECT Href, ETag, LastModified FROM vcards WHERE Section = ? AND Href IS NOT NULL"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, section.c_str(), section.length(), SQLITE_TRANSIENT);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW) {
+        CardValidators& v = (*validators)[reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0))];
+        if(sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+            v.etag = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+        if(sqlite3_column_type(stmt, 2) != SQLITE_NULL)
+            v.lastModified = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 2));
+    }
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to read the validators of section '" << section << "': " << sqlite3_errmsg(db) << std::endl;
+
+    finalizeSqlite();
+    return rc == SQLITE_DONE;
+}
+
+// copies the cards of href over from the previous cache as they are stored,
+// nothing is parsed or compressed again. Returns the number of cards, -1 on errors
+int Cache::copyPrevious(const std::string &section, const std::string &href) {
+    // the unary plus keeps sqlite off section_idx, which would scan the whole section for every card
+    sqlite3_stmt* cards = statement("SELECT VCardID, FirstName, LastName, VCard, Compressed, UpdatedAt, ETag, LastModified FROM previous.vcards WHERE Href = ? AND +Section = ?");
+    sqlite3_stmt* mails = statement("SELECT Mail FROM previous.emails WHERE VCardID = ?");
+    if(cards == NULL || mails == NULL)
+        return -1;
+
+    sqlite3_bind_text(cards, 1, href.c_str(), href.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(cards, 2, section.c_str(), section.size(), SQLITE_TRANSIENT);
+
+    int copied = 0;
+    while(sqlite3_step(cards) == SQLITE_ROW) {
+        std::string columns[7];
+        for(int i=0; i<7; i++) {
+            const char* value = reinterpret_cast<const char*>(sqlite3_column_blob(cards, i + 1));
+            columns[i].assign(value ? value : "", sqlite3_column_bytes(cards, i + 1));
+        }
+        bool compressed = sqlite3_column_int(cards, 4) != 0;
+
+        std::vector<std::string> emails;
+        sqlite3_reset(mails);
+        sqlite3_bind_int64(mails, 1, sqlite3_column_int64(cards, 0));
+        while(sqlite3_step(mails) == SQLITE_ROW)
+            emails.push_back(reinterpret_cast<const char*>(sqlite3_column_text(mails, 0)));
+
+        if(false == insertCard(columns[0], columns[1], emails, columns[2], compressed, columns[4], section, 0, href, columns[5], columns[6])) {
+            sqlite3_reset(cards);
+            return -1;
+        }
+        copied++;
+    }
+
+    sqlite3_reset(cards);
+    return copied;
+}
+
+// complete is set once the section was synced to the end, hrefs receives the cards stored so far
+bool Cache::getSyncProgress(const std::string &section, bool *complete, std::set<std::string> *hrefs) {
+    if(false == openDatabase())
+        return false;
+
+    *complete = false;
+    sqlite3_stmt* s = statement("SELECT Complete FROM sync_progress WHERE Section = ?");
+    if(s == NULL)
+        return false;
+
+    sqlite3_bind_text(s, 1, section.c_str(), section.size(), SQLITE_TRANSIENT);
+    if(sqlite3_step(s) == SQLITE_ROW)
+        *complete = sqlite3_column_int(s, 0) != 0;
+    sqlite3_reset(s);
+
+    if(false == prepSqlite("SELECT Href FROM vcards WHERE Section = ? AND Href IS NOT NULL"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, section.c_str(), section.length(), SQLITE_TRANSIENT);
+
+    int rc;
+    while((rc = sqlite3_step(stmt)) == SQLITE_ROW)
+        hrefs->insert(reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0)));
+
+    if(rc != SQLITE_DONE)
+        std::cerr << "Unable to read the progress of the sync: " << sqlite3_errmsg(db) << std::endl;
+
+    finalizeSqlite();
+    return rc == SQLITE_DONE;
+}
+
+bool Cache::setSectionSynced(const std::string &section) {
+    if(false == openDatabase())
+        return false;
+
+    sqlite3_stmt* s = statement("INSERT OR REPLACE INTO sync_progress (Section, Complete) VALUES (?, 1)");
+    if(s == NULL)
+        return false;
+
+    sqlite3_bind_text(s, 1, section.c_str(), section.size(), SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(s) == SQLITE_DONE;
+    if(false == ok)
+        std::cerr << "Unable to record the progress of the sync: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_reset(s);
+    return ok;
+}
+
+// url and ctag stay empty if the section was never synced completely
+bool Cache::getCollectionTag(const std::string &section, bool previous, std::string *url, std::string *ctag) {
+    if(false == openDatabase())
+        return false;
+
+    url->clear();
+    ctag->clear();
+    if(false == prepSqlite(previous ? "SELECT Url, CTag FROM previous.collections WHERE Section = ?" : "SELECT Url, CTag FROM collections WHERE Section = ?"))
+        return false;
+
+    sqlite3_bind_text(stmt, 1, section.c_str(), section.length(), SQLITE_TRANSIENT);
+
+    int rc = sqlite3_step(stmt);
+    if(rc == SQLITE_ROW) {
+        if(sqlite3_column_type(stmt, 0) != SQLITE_NULL)
+            *url = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 0));
+        if(sqlite3_column_type(stmt, 1) != SQLITE_NULL)
+            *ctag = reinterpret_cast<const char*>(sqlite3_column_text(stmt, 1));
+    } else if(rc != SQLITE_DONE) {
+        std::cerr << "Unable to read the ctag of config section [" << section << "]: " << sqlite3_errmsg(db) << std::endl;
+    }
+
+    finalizeSqlite();
+    return rc == SQLITE_ROW || rc == SQLITE_DONE;
+}
+
+bool Cache::setCollectionTag(const std::string &section, const std::string &url, const std::string &ctag) {
+    if(false == openDatabase())
+        return false;
+
+    sqlite3_stmt* s = statement("INSERT OR REPLACE INTO collections (Section, Url, CTag) VALUES (?, ?, ?)");
+    if(s == NULL)
+        return false;
+
+    sqlite3_bind_text(s, 1, section.c_str(), section.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(s, 2, url.c_str(), url.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(s, 3, ctag.c_str(), ctag.size(), SQLITE_TRANSIENT);
+    bool ok = sqlite3_step(s) == SQLITE_DONE;
+    if(false == ok)
+        std::cerr << "Unable to store the ctag of config section [" << section << "]: " << sqlite3_errmsg(db) << std::endl;
+    sqlite3_reset(s);
+    return ok;
+}
+
+bool Cache::getFile(const std::string &path, CachedFile *file) {
+    if(false == openDatabase())
+        return false;
+
+    sqlite3_stmt* s = statement("SELECT FileID, MTime, Size FROM files WHERE Path = ?");
+    if(s == NULL)
+        return false;
+
+    sqlite3_bind_text(s, 1, path.c_str(), path.size(), SQLITE_TRANSIENT);
+    bool found = sqlite3_step(s) == SQLITE_ROW;
+    if(found) {
+        file->id = sqlite3_column_int64(s, 0);
+        file->mtime = sqlite3_column_int64(s, 1);
+        file->size = sqlite3_column_int64(s, 2);
+    }
+    sqlite3_reset(s);
+    return found;
+}
+
+// remembers the state of an imported file, returns its id or 0 on failure
+sqlite3_int64 Cache::setFile(const std::string &section, const std::string &path, long long mtime, long long size) {
+    sqlite3_stmt* s = statement("INSERT INTO files (Path, Section, MTime, Size) VALUES (?, ?, ?, ?)"
+                                " ON CONFLICT(Path) DO UPDATE SET Section = excluded.Section, MTime = excluded.MTime, Size = excluded.Size");
+    sqlite3_stmt* id = statement("SELECT FileID FROM files WHERE Path = ?");
+    if(s == NULL || id == NULL)
+        return 0;
+
+    sqlite3_bind_text(s, 1, path.c_str(), path.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_text(s, 2, section.c_str(), section.size(), SQLITE_TRANSIENT);
+    sqlite3_bind_int64(s, 3, mtime);
+    sqlite3_bind_int64(s, 4, size);
+    if(sqlite3_step(s) != SQLITE_DONE) {
+        std::cerr << "Failed to add file '" << path << "' to cache: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_reset(s);
+        return 0;
+    }
+    sqlite3_reset(s);
+
+    sqlite3_bind_text(id, 1, path.c_str(), path.size(), SQLITE_TRANSIENT);
+    sqlite3_int64 fileId = sqlite3_step(id) == SQLITE_ROW ? sqlite3_column_int64(id, 0) : 0;
+    sqlite3_reset(id);
+    return fileId;
+}
+
+// removes the cards read from a file, forget drops the file itself as well
+bool Cache::clearFile(sqlite3_int64 fileId, bool forget) {
+    const char* queries[] = {
+        "DELETE FROM emails WHERE VCardID IN (SELECT VCardID FROM vcards WHERE FileID = ?)",
+        "DELETE FROM term_cards WHERE VCardID IN (SELECT VCardID FROM vcards WHERE FileID = ?)",
+        "DELETE FROM vcards WHERE FileID = ?",
+        "DELETE FROM files WHERE FileID = ?"
+    };
+
+    for(int i=0; i<(forget ? 4 : 3); i++) {
+        sqlite3_stmt* s = statement(queries[i]);
+        if(s == NULL)
+            return false;
+
+        sqlite3_bind_int64(s, 1, fileId);
+        int rc = sqlite3_step(s);
+        sqlite3_reset(s);
+        if(rc != SQLITE_DONE) {
+            std::cerr << "Failed to remove the cards of file " << fileId << " from cache: " << sqlite3_errmsg(db) << std::endl;
+            return false;
+        }
+    }
+
+    return true;
+}
+
+// Opens the new cache an interrupted --create-local-cache left behind
+bool Cache::resumeDatabase() {
+    shadow_file = cache_file + ".tmp";
+    if(false == lockShadow())
+        return false;
+
+    if(false == FileUtils::fileExists(shadow_file)) {
+        std::cerr << "There is no interrupted cache rebuild to resume, run --create-local-cache without --resume" << std::endl;
+        shadow_file = "";
+        return false;
+    }
+
+    if(false == initSqlite())
+        return false;
+
+    int retVal = sqlite3_open_v2(shadow_file.c_str(), &db, SQLITE_OPEN_READWRITE, NULL);
+    if(SQLITE_OK != retVal) {
+        std::cerr << "Can't open database in " << shadow_file << ": " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    if(false == checkSchemaVersion()) {
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    loadStorageOptions();
+    return true;
+}
+
+// One rebuild at a time: a second one would remove or write into the shadow file
+// of the first. The lock goes with the process, a crashed run never leaves it held
+bool Cache::lockShadow() {
+    std::string lockFile = shadow_file + ".lock";
+    shadowLock = open(lockFile.c_str(), O_RDWR | O_CREAT, S_IRUSR | S_IWUSR);
+    if(shadowLock >= 0 && flock(shadowLock, LOCK_EX | LOCK_NB) == 0)
+        return true;
+
+    if(shadowLock < 0)
+        std::cerr << "Can't open lock file '" << lockFile << "'" << std::endl;
+    else
+        std::cerr << "Another cache rebuild is running, the cache was left alone" << std::endl;
+
+    // not ours to remove
+    shadow_file = "";
+    return false;
+}
+
+// leaves the new cache for --resume instead of dropping it, commit what should be kept first
+void Cache::keepPartialDatabase() {
+    keepShadow = true;
+}
+
+// atomically replaces the old cache with the freshly built one
+bool Cache::commitDatabase() {
+    if(shadow_file.size() == 0 || db == NULL) {
+        std::cerr << "No cache database under construction" << std::endl;
+        return false;
+    }
+
+    if(searchStmt) {
+        sqlite3_finalize(searchStmt);
+        searchStmt = NULL;
+    }
+    finalizeStatements();
+
+    int retVal = sqlite3_close(db);
+    db = NULL;
+    if(SQLITE_OK != retVal) {
+        std::cerr << "Failed to close new cache database '" << shadow_file << "'" << std::endl;
+        return false;
+    }
+
+    chmod(shadow_file.c_str(), S_IRUSR | S_IWUSR);
+
+    if(rename(shadow_file.c_str(), cache_file.c_str()) != 0) {
+        std::cerr << "Failed to move new cache database '" << shadow_file << "' to '" << cache_file << "'" << std::endl;
+        return false;
+    }
+
+    shadow_file = "";
+    std::cout << "New cache database created in '" << cache_file << "'" << std::endl;
+    return true;
+}
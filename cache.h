@@ -31,37 +31,125 @@
 #include <locale>
 #include <vector>
 #include <fstream>
+#include <map>
+#include <set>
 
 #include "settings.h"
 #include "person.h"
 #include "fileutils.h"
 #include "option.h"
+#include "cardcompressor.h"
+#include "resultwriter.h"
+#include "sqlitetimeout.h"
+
+// bump this whenever the table layout changes, older caches must be recreated
+#define CACHE_SCHEMA_VERSION 9
+
+// completions returned by --complete without --limit
+#define DEFAULT_COMPLETE_LIMIT 10
+
+// a file of a local section as it was when it was imported
+struct CachedFile
+{
+    sqlite3_int64 id;
+    long long mtime; // nanoseconds
+    long long size;
+};
 
 class Cache
 {
 public:
     Cache();
+    explicit Cache(const std::string& cacheFile);
     ~Cache();
 
     static void trace_cb(void* udp, const char* sql);
 
     bool openDatabase();
     bool createDatabase();
-    std::vector<Person> findInCache(const std::string &query);
-    void addVCard(const std::string& fn, const std::string& ln, const std::vector< std::string > &emails, const std::string& data, const std::string& updatedAt);
+    bool resumeDatabase();
+    bool commitDatabase();
+    void keepPartialDatabase();
+    bool setStorageOptions(bool compress, bool strip);
+    bool trainDictionary(const std::vector<std::string>& samples);
+    bool getVCardData(sqlite3_int64 vcardId, std::string* data);
+    int writeFromCache(const std::string &query, const std::vector<std::string> &sections, ResultWriter* writer);
+    int writeFuzzyFromCache(const std::string &query, const std::vector<std::string> &sections, int limit, ResultWriter* writer);
+    int writeCompletions(const std::string &prefix, const std::vector<std::string> &sections, int limit, ResultWriter* writer);
+    bool allEntries(std::vector<Person>* people);
+    void addVCard(const std::string& fn, const std::string& ln, const std::vector< std::string > &emails, const std::string& data, const std::string& updatedAt, const std::string& section, sqlite3_int64 fileId = 0, const std::string& href = std::string(), const std::string& etag = std::string(), const std::string& lastModified = std::string());
+
+    // the cache a full sync replaces, its unchanged cards are copied instead of downloaded
+    bool attachPrevious(const std::string& file);
+    int copyPrevious(const std::string& section, const std::string& href);
+
+    // what the server said about the cards of section in this or the previous cache
+    bool getValidators(const std::string& section, bool previous, std::map<std::string, CardValidators>* validators);
+
+    // progress of a full sync into a new cache, so --resume can skip what is done
+    bool getSyncProgress(const std::string& section, bool* complete, std::set<std::string>* hrefs);
+    bool setSectionSynced(const std::string& section);
+
+    // the ctag a section's collection had when it was synced last, from this or the previous cache
+    bool getCollectionTag(const std::string& section, bool previous, std::string* url, std::string* ctag);
+    bool setCollectionTag(const std::string& section, const std::string& url, const std::string& ctag);
+
+    // the files of local sections, the cards of a file are replaced as a whole
+    bool getFiles(const std::string& section, std::map<std::string, CachedFile>* files);
+    bool getFile(const std::string& path, CachedFile* file);
+    sqlite3_int64 setFile(const std::string& section, const std::string& path, long long mtime, long long size);
+    bool clearFile(sqlite3_int64 fileId, bool forget);
+
+    bool beginTransaction();
+    bool commitTransaction();
+    void rollbackTransaction();
+
+    // a section refreshed in place keeps its unchanged cards and drops the others one by one
+    bool getSectionCards(const std::string& section, std::multimap<std::string, sqlite3_int64>* cards);
+    bool removeCard(sqlite3_int64 id);
 
 private:
-    Settings cfg;
     sqlite3* db;
     sqlite3_stmt *stmt;
+
+    // the search statement, kept prepared for repeated searches
+    sqlite3_stmt *searchStmt;
+    std::vector<std::string> searchSections;
+
+    // statements run once per card or term, prepared once and reset between uses
+    std::map<std::string, sqlite3_stmt*> statements;
     std::string cache_file;
 
+    // a new cache is built here and renamed over cache_file on success
+    std::string shadow_file;
+    bool keepShadow;
+    int shadowLock;
+
+    // storage options, persisted in table 'meta'
+    bool compressCards;
+    bool stripBinary;
+    std::string dictionary;
+
     bool initSqlite();
     bool prepSqlite(const std::string &query);
+    bool prepareSearch(const std::string &query, const std::vector<std::string> &sections);
+    bool prepareSearchStatement(const std::vector<std::string> &sections);
     bool stepSqlite(const std::string &errMsg);
     bool finalizeSqlite();
+    sqlite3_stmt* statement(const std::string &query);
+    void finalizeStatements();
+    bool execSqlite(const std::string &query, const std::string &errMsg);
+    bool checkSchemaVersion();
+    bool lockShadow();
+    bool setMeta(const std::string &key, const std::string &value);
+    bool getMeta(const std::string &key, std::string *value);
+    void loadStorageOptions();
 
+    bool insertCard(const std::string& fn, const std::string& ln, const std::vector< std::string > &emails, const std::string& stored, bool compressed, const std::string& updatedAt, const std::string& section, sqlite3_int64 fileId, const std::string& href, const std::string& etag, const std::string& lastModified);
     void addEmails(const std::vector< std::string > &emails, int rowID);
+    void addTerms(const std::string& fn, const std::string& ln, const std::vector< std::string > &emails, sqlite3_int64 rowID);
+    bool fuzzyTerms(const std::string &term, std::map<sqlite3_int64, int> *termDistances);
+    int writeRange(const std::string &query, const std::string &from, const std::vector<std::string> &required, const std::vector<std::string> &sections, int limit, ResultWriter* writer);
 
     std::string buildDateTimeString(const std::string& dtString);
     std::string toNarrow(const std::string& text);
@@ -0,0 +1,147 @@
+#include "cacheimporter.h"
+#include "stats.h"
+
+CacheImporter::CacheImporter(Cache *cache, Mode mode)
+    : cache(cache),
+      mode(mode),
+      // a resumed cache was maybe interrupted before its first batch and local cards may
+      // be the first a new cache gets, trainDictionary keeps a dictionary that exists
+      trained(mode == ReplaceSections),
+      writeFailed(false),
+      numCards(0),
+      sectionLoaded(false)
+{
+}
+
+void CacheImporter::setSection(const std::string &section) {
+    this->section = section;
+    sectionLoaded = false;
+    oldCards.clear();
+}
+
+bool CacheImporter::loadSection() {
+    if(mode != ReplaceSections || sectionLoaded)
+        return true;
+
+    if(false == cache->getSectionCards(section, &oldCards)) {
+        writeFailed = true;
+        return false;
+    }
+    sectionLoaded = true;
+    return true;
+}
+
+bool CacheImporter::addCards(std::vector<Person> &people) {
+    StatsTimer timer("CacheImporter::addCards");
+
+    if(people.size() == 0)
+        return true;
+
+    if(false == trained) {
+        std::vector<std::string> samples;
+        for(unsigned int i=0; i<people.size(); i++)
+            samples.push_back(people.at(i).rawCardData);
+
+        if(false == cache->trainDictionary(samples)) {
+            writeFailed = true;
+            return false;
+        }
+        trained = true;
+    }
+
+    if(false == loadSection())
+        return false;
+
+    for(unsigned int i=0; i<people.size(); i++) {
+        const Person& p = people.at(i);
+        cache->addVCard(p.FirstName, p.LastName, p.Emails, p.rawCardData, p.lastUpdatedAt, section, p.fileId, p.href, p.validators.etag, p.validators.lastModified);
+        numCards++;
+    }
+
+    return checkpoint();
+}
+
+// the cards of the previous cache are copied over, a replaced section keeps its own
+int CacheImporter::keepCards(const std::vector<std::string> &hrefs) {
+    StatsTimer timer("CacheImporter::keepCards");
+
+    int kept = 0;
+    if(mode == ReplaceSections) {
+        if(false == loadSection())
+            return -1;
+
+        for(unsigned int i=0; i<hrefs.size(); i++) {
+            kept += oldCards.count(hrefs.at(i));
+            oldCards.erase(hrefs.at(i));
+        }
+
+        numCards += kept;
+        return kept;
+    }
+
+    for(unsigned int i=0; i<hrefs.size(); i++) {
+        int copied = cache->copyPrevious(section, hrefs.at(i));
+        if(copied < 0) {
+            writeFailed = true;
+            return -1;
+        }
+        kept += copied;
+    }
+
+    numCards += kept;
+    return checkpoint() ? kept : -1;
+}
+
+bool CacheImporter::finishSection() {
+    // a section the server has no cards for any more gets no batch to load it
+    if(false == loadSection())
+        return false;
+
+    for(std::multimap<std::string, sqlite3_int64>::const_iterator it = oldCards.begin(); it != oldCards.end(); ++it) {
+        if(false == cache->removeCard(it->second)) {
+            writeFailed = true;
+            return false;
+        }
+    }
+
+    oldCards.clear();
+    sectionLoaded = false;
+    return true;
+}
+
+// the cards so far survive an interrupted sync
+bool CacheImporter::checkpoint() {
+    if(mode == ReplaceSections || mode == LocalFiles)
+        return true;
+
+    if(false == cache->commitTransaction() || false == cache->beginTransaction()) {
+        writeFailed = true;
+        return false;
+    }
+
+    Stats::count("sync_checkpoints");
+    return true;
+}
+
+bool CacheImporter::finishTraining() {
+    if(trained)
+        return true;
+
+    trained = true;
+    return cache->trainDictionary(std::vector<std::string>());
+}
+
+int CacheImporter::count() const {
+    return numCards;
+}
+
+bool CacheImporter::failed() const {
+    return writeFailed;
+}
+
+size_t CacheImporter::batchBytes(int maxMemoryMB) {
+    if(maxMemoryMB <= 0)
+        maxMemoryMB = DEFAULT_MAX_MEMORY_MB;
+
+    return (size_t)maxMemoryMB * 1024 * 1024 / 4;
+}
@@ -0,0 +1,71 @@
+#ifndef CACHEIMPORTER_H
+#define CACHEIMPORTER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "cache.h"
+#include "cardcurler.h"
+
+// memory --create-local-cache may use for the cards in flight, in MB
+#define DEFAULT_MAX_MEMORY_MB 64
+
+// Writes the batches of a sync into the cache while the download goes on.
+// A cache without a dictionary is trained for compression by the first batch
+// and each batch of a new cache is committed with the sync progress, so an
+// interrupted sync can be resumed.
+// When sections are replaced, the cards the server did not report as unchanged
+// are dropped by finishSection, a server that returns nothing empties the section,
+// and everything stays in the one transaction of the caller. The cards of local
+// files are replaced file by file by LocalSource, in the caller's transaction.
+class CacheImporter : public CardSink
+{
+public:
+    enum Mode {
+        NewCache,
+        ResumeCache,
+        ReplaceSections,
+        LocalFiles
+    };
+
+    CacheImporter(Cache* cache, Mode mode);
+
+    // the config section of the batches that follow
+    void setSection(const std::string& section);
+    bool addCards(std::vector<Person>& people);
+    int keepCards(const std::vector<std::string>& hrefs);
+
+    // drops the old cards of a replaced section that were not kept, call it once the section is synced
+    bool finishSection();
+
+    // trains the dictionary if no batch did, call it before adding other cards
+    bool finishTraining();
+
+    int count() const;
+
+    // TRUE once writing to the cache failed, as opposed to an interrupted download
+    bool failed() const;
+
+    // the vcard text a batch may hold within a budget of maxMemoryMB. A batch
+    // is in memory up to three times: as text, parsed and on its way into the
+    // cache, the rest is left to sqlite's page cache and the download buffer
+    static size_t batchBytes(int maxMemoryMB);
+
+private:
+    Cache* cache;
+    Mode mode;
+    bool trained;
+    bool writeFailed;
+    std::string section;
+    int numCards;
+
+    // the cards a replaced section had before the sync, by href. Loaded with the
+    // first batch or by finishSection, whatever is not kept is dropped by it
+    bool sectionLoaded;
+    std::multimap<std::string, sqlite3_int64> oldCards;
+
+    bool loadSection();
+    bool checkpoint();
+};
+
+#endif // CACHEIMPORTER_H
@@ -0,0 +1,165 @@
+#include "cardcompressor.h"
+#include <zlib.h>
+#include <map>
+#include <algorithm>
+
+// zlib only looks at the last 32K of a preset dictionary
+#define MAX_DICTIONARY_SIZE 32768
+
+// number of cards used to build the dictionary
+#define MAX_DICTIONARY_SAMPLES 256
+
+CardCompressor::CardCompressor()
+{
+}
+
+// PHOTO;ENCODING=b;TYPE=JPEG:... or item1.LOGO:... - the property name
+// is everything before the first ';' or ':' without the group prefix
+bool CardCompressor::isBinaryProperty(const std::string &line) {
+    size_t end = line.find_first_of(";:");
+    if(end == std::string::npos)
+        return false;
+
+    std::string name = line.substr(0, end);
+    size_t dot = name.rfind('.');
+    if(dot != std::string::npos)
+        name = name.substr(dot + 1);
+
+    std::transform(name.begin(), name.end(), name.begin(), ::toupper);
+    return name == "PHOTO" || name == "LOGO" || name == "SOUND" || name == "KEY";
+}
+
+// removes binary properties including their folded continuation lines
+std::string CardCompressor::stripBinary(const std::string &raw) {
+    std::string result;
+    result.reserve(raw.size());
+
+    bool skipping = false;
+    size_t pos = 0;
+    while(pos < raw.size()) {
+        size_t eol = raw.find('\n', pos);
+        size_t next = (eol == std::string::npos) ? raw.size() : eol + 1;
+
+        // folded lines belong to the previous property
+        bool folded = raw[pos] == ' ' || raw[pos] == '\t';
+        if(!folded)
+            skipping = isBinaryProperty(raw.substr(pos, next - pos));
+
+        if(!skipping)
+            result.append(raw, pos, next - pos);
+
+        pos = next;
+    }
+
+    return result;
+}
+
+// Collects the property prefixes (everything up to and including the ':')
+// of the sample cards and joins them, most frequent last, into a dictionary.
+// Lines without a value of their own, like BEGIN:VCARD, are taken verbatim.
+std::string CardCompressor::trainDictionary(const std::vector<std::string> &samples) {
+    std::map<std::string, int> counts;
+
+    for(unsigned int i=0; i<samples.size() && i<MAX_DICTIONARY_SAMPLES; i++) {
+        const std::string& card = samples.at(i);
+        size_t pos = 0;
+        while(pos < card.size()) {
+            size_t eol = card.find('\n', pos);
+            size_t next = (eol == std::string::npos) ? card.size() : eol + 1;
+
+            if(card[pos] != ' ' && card[pos] != '\t') {
+                std::string line = card.substr(pos, next - pos);
+                size_t colon = line.find(':');
+                if(colon != std::string::npos && line.compare(0, 6, "BEGIN:") != 0
+                        && line.compare(0, 4, "END:") != 0 && line.compare(0, 8, "VERSION:") != 0) {
+                    line = line.substr(0, colon + 1);
+                }
+                counts[line]++;
+            }
+
+            pos = next;
+        }
+    }
+
+    // only strings seen at least twice are worth a place in the dictionary
+    std::vector< std::pair<int, std::string> > ranked;
+    for(std::map<std::string, int>::const_iterator it = counts.begin(); it != counts.end(); ++it) {
+        if(it->second > 1)
+            ranked.push_back(std::make_pair(it->second, it->first));
+    }
+    std::sort(ranked.begin(), ranked.end());
+
+    std::string dictionary;
+    for(std::vector< std::pair<int, std::string> >::reverse_iterator it = ranked.rbegin(); it != ranked.rend(); ++it) {
+        if(dictionary.size() + it->second.size() > MAX_DICTIONARY_SIZE)
+            break;
+        dictionary.insert(0, it->second);
+    }
+
+    return dictionary;
+}
+
+bool CardCompressor::compress(const std::string &in, const std::string &dictionary, std::string *out) {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+
+    if(deflateInit(&zs, Z_BEST_COMPRESSION) != Z_OK)
+        return false;
+
+    if(dictionary.size() > 0) {
+        if(deflateSetDictionary(&zs, (const Bytef*)dictionary.data(), dictionary.size()) != Z_OK) {
+            deflateEnd(&zs);
+            return false;
+        }
+    }
+
+    out->resize(deflateBound(&zs, in.size()));
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+    zs.next_out = (Bytef*)&(*out)[0];
+    zs.avail_out = out->size();
+
+    int retVal = deflate(&zs, Z_FINISH);
+    out->resize(zs.total_out);
+    deflateEnd(&zs);
+
+    return retVal == Z_STREAM_END;
+}
+
+bool CardCompressor::decompress(const std::string &in, const std::string &dictionary, std::string *out) {
+    z_stream zs;
+    zs.zalloc = Z_NULL;
+    zs.zfree = Z_NULL;
+    zs.opaque = Z_NULL;
+    zs.next_in = (Bytef*)in.data();
+    zs.avail_in = in.size();
+
+    if(inflateInit(&zs) != Z_OK)
+        return false;
+
+    out->clear();
+    char buffer[16384];
+    int retVal = Z_OK;
+    while(retVal != Z_STREAM_END) {
+        zs.next_out = (Bytef*)buffer;
+        zs.avail_out = sizeof(buffer);
+
+        retVal = inflate(&zs, Z_NO_FLUSH);
+        if(retVal == Z_NEED_DICT) {
+            retVal = inflateSetDictionary(&zs, (const Bytef*)dictionary.data(), dictionary.size());
+            if(retVal != Z_OK)
+                break;
+            continue;
+        }
+
+        if(retVal != Z_OK && retVal != Z_STREAM_END)
+            break;
+
+        out->append(buffer, sizeof(buffer) - zs.avail_out);
+    }
+
+    inflateEnd(&zs);
+    return retVal == Z_STREAM_END;
+}
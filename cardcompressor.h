@@ -0,0 +1,24 @@
+#ifndef CARDCOMPRESSOR_H
+#define CARDCOMPRESSOR_H
+
+#include <string>
+#include <vector>
+
+// Shrinks raw vcard data before it is stored in the cache.
+// Binary properties (PHOTO, LOGO, SOUND, KEY) can be stripped
+// and the remaining text is deflated with zlib using a preset
+// dictionary built from a sample of the address book.
+class CardCompressor
+{
+public:
+    CardCompressor();
+    static std::string stripBinary(const std::string& raw);
+    static std::string trainDictionary(const std::vector<std::string>& samples);
+    static bool compress(const std::string& in, const std::string& dictionary, std::string* out);
+    static bool decompress(const std::string& in, const std::string& dictionary, std::string* out);
+
+private:
+    static bool isBinaryProperty(const std::string& line);
+};
+
+#endif // CARDCOMPRESSOR_H
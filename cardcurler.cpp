@@ -21,7 +21,16 @@
 #include "cardcurler.h"
 #include "option.h"
 #include "cache.h"
+#include "url.h"
 #include "vCard/strutils.h"
+#include "stats.h"
+#include "curlmetrics.h"
+#include "curllib.h"
+#include "parallelparser.h"
+#include "syncpipeline.h"
+#include <thread>
+#include <chrono>
+#include <strings.h>
 
 /*
  * CTOR
@@ -32,9 +41,34 @@ CardCurler::CardCurler(const std::string &username, const std::string &password,
     _username = username;
     _password = password;
     _rawQuery = rawQuery;
+    _section  = url;
 
     exportMode = false;
-    isSOGO = false;
+    curl = NULL;
+}
+
+CardCurler::~CardCurler()
+{
+    if(curl)
+        CurlLib::get()->easy_cleanup(curl);
+}
+
+// the easy handle of this curler, reset to the defaults but still connected
+CURL* CardCurler::handle() {
+    const CurlApi* lib = CurlLib::get();
+    if(lib == NULL)
+        return NULL;
+
+    if(curl)
+        lib->easy_reset(curl);
+    else
+        curl = lib->easy_init();
+
+    return curl;
+}
+
+void CardCurler::setSection(const std::string &section) {
+    _section = section;
 }
 
 /*
@@ -42,27 +76,102 @@ CardCurler::CardCurler(const std::string &username, const std::string &password,
  * Returns a vector of strings of all url's found by the XML query given
  *
  * @query : the xml snippet the carddav server expects to receive
- * @return: a vector<std::string> of raw vcard strings (BEGIN:VCARD ... END:VCARD)
+ * @urls  : receives the url's of the vcards
+ * @return: FALSE if the server could not be asked even after retrying, TRUE otherwise
  */
-std::vector<std::string> CardCurler::getvCardURLs(const std::string &query) {
+bool CardCurler::getvCardURLs(const std::string &query, std::vector<std::string> *urls) {
 
     if(Option::isVerbose()) {
         std::cout << "CardCurler::getvCardURLs using query parameter: " << query << std::endl;
     }
 
-    std::string s = get("PROPFIND", query);
+    std::string s;
+    if(false == get("PROPFIND", query, &s, 1, SYNC_RETRIES))
+        return false;
 
     if(Option::isVerbose()) {
         std::cout << "CardCurler::getvCardURLs got PROPFIND result: " << s << std::endl;
     }
 
+    // the listing names the collection itself too, it is no card
+    std::string base(Url::removePath(_url));
+    std::string path(_url.compare(0, base.size(), base) == 0 ? _url.substr(base.size()) : _url);
+    if(path.size() > 0 && path[path.size() - 1] == '/')
+        path.erase(path.size() - 1);
+
+    std::vector<std::string> hrefs = parseHrefs(s);
+    urls->clear();
+    for(unsigned int i=0; i<hrefs.size(); i++) {
+        const std::string& href = hrefs.at(i);
+        if(href == _url || href == path || href == path + "/")
+            continue;
+        urls->push_back(href);
+    }
+    return true;
+}
+
+/*
+ * Asks for the properties of the collection alone (Depth: 0), which
+ * is a small request no matter how many cards the collection holds.
+ *
+ * @query : the xml snippet the carddav server expects to receive
+ * @ctag  : receives the ctag of the collection, empty if the server sent none
+ * @return: FALSE if the server could not be asked even after retrying, TRUE otherwise
+ */
+bool CardCurler::getCTag(const std::string &query, std::string *ctag) {
+    std::string s;
+    if(false == get("PROPFIND", query, &s, 0, SYNC_RETRIES))
+        return false;
+
+    if(Option::isVerbose()) {
+        std::cout << "CardCurler::getCTag got PROPFIND result: " << s << std::endl;
+    }
+
+    *ctag = parseCTag(s);
+    return true;
+}
+
+/*
+ * Extracts the getctag property from a PROPFIND response, whatever
+ * namespace prefix the server chose for it.
+ *
+ * @response: the raw PROPFIND response body
+ * @return  : the ctag, empty if there is none
+ */
+std::string CardCurler::parseCTag(const std::string &response) {
+    size_t pos = response.find("getctag");
+    if(pos == std::string::npos)
+        return std::string();
+
+    // <getctag/> is a property the server does not know
+    size_t begin = response.find('>', pos);
+    if(begin == std::string::npos || response[begin - 1] == '/')
+        return std::string();
+
+    size_t end = response.find('<', begin);
+    if(end == std::string::npos)
+        return std::string();
+
+    std::string ctag = response.substr(begin + 1, end - begin - 1);
+    return StrUtils::trim(ctag);
+}
+
+/*
+ * Extracts the href's from a PROPFIND response. The namespace prefix
+ * of the href element differs between the carddav servers.
+ *
+ * @response: the raw PROPFIND response body
+ * @return  : a vector<std::string> of all href's found
+ */
+std::vector<std::string> CardCurler::parseHrefs(const std::string &response) {
+    const std::string& s = response;
+
     // check xml case D:href (SOGo) or d:href (owncloud)
     std::string href_begin = "<d:href>";
     std::string href_end = "</d:href>";
     if( StringUtils::contains(s, "D:href") ) {
         href_begin = "<D:href>";
         href_end   = "</D:href>";
-        isSOGO = true;
 
         if(Option::isVerbose()) {
             std::cout << "Found SoGO namespace" << std::endl;
@@ -112,113 +221,258 @@ std::vector<std::string> CardCurler::getvCardURLs(const std::string &query) {
     return result;
 }
 
+// keeps every batch, for callers which want the whole address book at once
+class PersonCollector : public CardSink
+{
+public:
+    std::vector<Person> people;
+
+    bool addCards(std::vector<Person>& batch) {
+        people.insert(people.end(), batch.begin(), batch.end());
+        return true;
+    }
+
+    // no validators are sent, so no card is ever kept
+    int keepCards(const std::vector<std::string>&) {
+        return 0;
+    }
+};
+
 /*
  * This public method used to fetch all cards for a given account.
  *
- * First it will ask the carddav server for the url's and then
- * walk through each of the url's and download the vcard. If
- * possible it will not end the connection after each download.
- * It will cancel the action on any given failure given by libcurl
- * and return whatever vcards where read at the given moment.
- *
  * @server: a full qualified hostname with protocol spec, i.e. http(s)://www.johndoe.com
  * @query : the xml snippet the carddav server expects to receive
  *
  * @return: returns a Qlist of Person objects
  */
 std::vector<Person> CardCurler::getAllCards(const std::string &server, const std::string &query) {
+    PersonCollector collector;
+    getAllCards(server, query, &collector);
+    return collector.people;
+}
 
-    if(Option::isVerbose()) {
-        std::cout << "CardCurler::getAllCards called. Server: " << server << std::endl;
-        std::cout << "CardCurler::getAllCards called. Query: " << query << std::endl;
-    }
+// downloads the cards of a sync over a handful of connections, one handle each.
+// A failed download is retried after SYNC_RETRY_DELAY_MS, the delay doubling
+// with each of the SYNC_RETRIES attempts, before it ends the sync. Any other
+// answer than 2xx or 304, i.e. 401, 403 or 404, ends it right away, the card
+// would otherwise be missing from the new cache
+class CardDownloader : public CardFetcher
+{
+public:
+    CardDownloader(const std::string& server, const std::string& section, const std::vector<std::string>& urls, const std::vector<CURL*>& handles, const std::map<std::string, CardValidators>* known)
+        : server(server), section(section), urls(urls), handles(handles), known(known) {}
 
-    std::vector<Person> persons;
+    bool fetch(unsigned int connection, size_t index, FetchedCard* card) {
+        const CurlApi* lib = CurlLib::get();
+        CURL* curl = handles.at(connection);
+        std::string url(server + urls.at(index));
 
-    exportMode = true;
+        // a card we have is only sent again if it changed
+        struct curl_slist *headers = NULL;
+        std::map<std::string, CardValidators>::const_iterator it;
+        if(known && (it = known->find(urls.at(index))) != known->end()) {
+            if(it->second.etag.size() > 0)
+                headers = lib->slist_append(headers, ("If-None-Match: " + it->second.etag).c_str());
+            if(it->second.lastModified.size() > 0)
+                headers = lib->slist_append(headers, ("If-Modified-Since: " + it->second.lastModified).c_str());
+        }
 
-    CURL *curl;
-    CURLcode res;
+        lib->easy_setopt(curl, CURLOPT_URL, url.c_str());
+        lib->easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        lib->easy_setopt(curl, CURLOPT_WRITEDATA, &card->body);
+        lib->easy_setopt(curl, CURLOPT_HEADERFUNCTION, &CardDownloader::headerFunc);
+        lib->easy_setopt(curl, CURLOPT_HEADERDATA, &card->validators);
 
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
+        long status = 0;
+        for(int attempt=0; ; attempt++) {
+            if(Option::isVerbose()) {
+                std::cout << "Curling url " + url + "\n" << std::flush;
+            }
 
-    std::vector< std::string > cardUrls = getvCardURLs(query);
+            card->body.clear();
+            card->validators = CardValidators();
+            CURLcode res = lib->easy_perform(curl);
+            CurlMetrics::record(section, curl, true);
 
-    if(Option::isVerbose()) {
-        std::cout << "Number of card urls: " << cardUrls.size() << std::endl;
+            status = 0;
+            if(res == CURLE_OK)
+                lib->easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
+
+            // the server or the way there may be back in a moment
+            bool transient = res != CURLE_OK || status == 429 || status >= 500;
+            if(false == transient)
+                break;
+
+            std::stringstream reason;
+            if(res != CURLE_OK)
+                reason << lib->easy_strerror(res);
+            else
+                reason << "HTTP " << status;
+
+            if(attempt == SYNC_RETRIES) {
+                std::cerr << "CardCurler::getVCard() failed on URL: " + urls.at(index) + ", Code: " + reason.str() + "\n";
+                lib->slist_free_all(headers);
+                return false;
+            }
+
+            int delay = SYNC_RETRY_DELAY_MS << attempt;
+            std::stringstream retry;
+            retry << "Download of " << urls.at(index) << " failed (" << reason.str() << "), retrying in " << delay << " ms\n";
+            std::cerr << retry.str();
+            Stats::count("sync_retries");
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        }
+
+        lib->easy_setopt(curl, CURLOPT_HTTPHEADER, NULL);
+        lib->slist_free_all(headers);
+
+        if(status == 304) {
+            card->body.clear();
+            card->notModified = true;
+            return true;
+        }
+
+        if(status < 200 || status >= 300) {
+            std::stringstream reason;
+            reason << "CardCurler::getVCard() failed on URL: " << urls.at(index) << ", Code: HTTP " << status << "\n";
+            std::cerr << reason.str();
+            card->body.clear();
+            return false;
+        }
+
+        // a single write, the lines of the connections must not mix
+        if(card->body.size() > 0)
+            std::cout << "fetched vcard from: " + url + "\n" << std::flush;
+
+        return true;
     }
 
-    if(curl && cardUrls.size() > 0) {
+    const std::string& href(size_t index) const {
+        return urls.at(index);
+    }
 
-        if(Option::isVerbose()) {
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+private:
+    const std::string& server;
+    const std::string& section;
+    const std::vector<std::string>& urls;
+    const std::vector<CURL*>& handles;
+    const std::map<std::string, CardValidators>* known;
+
+    // picks ETag and Last-Modified out of the response headers
+    static size_t headerFunc(char *buffer, size_t size, size_t nitems, void *userp) {
+        CardValidators* validators = static_cast<CardValidators*>(userp);
+        size_t length = size * nitems;
+        std::string line(buffer, length);
+        if(length > 5 && strncasecmp(buffer, "etag:", 5) == 0) {
+            std::string value = line.substr(5);
+            validators->etag = StrUtils::trim(value);
+        } else if(length > 14 && strncasecmp(buffer, "last-modified:", 14) == 0) {
+            std::string value = line.substr(14);
+            validators->lastModified = StrUtils::trim(value);
         }
+        return length;
+    }
+};
 
-        std::string card;
+/*
+ * Fetches all cards of an account and hands them to sink in batches.
+ *
+ * First it will ask the carddav server for the url's and then
+ * download the vcards over up to SYNC_CONNECTIONS connections, each kept
+ * open for all of its downloads, while other threads parse them and the
+ * calling thread passes them to sink, see SyncPipeline. It will cancel
+ * the action on any given failure given by libcurl and keep whatever
+ * vcards where read at the given moment.
+ *
+ * The cards reach sink in the order of the urls, in batches of
+ * SYNC_BATCH_CARDS cards or half of maxBatchBytes bytes of vcard text.
+ * Downloads wait while maxBatchBytes are on their way to sink, so memory
+ * use depends on the batch size and not on the size of the address book.
+ *
+ * @server       : a full qualified hostname with protocol spec, i.e. http(s)://www.johndoe.com
+ * @query        : the xml snippet the carddav server expects to receive
+ * @sink         : receives the Persons, batch by batch
+ * @maxBatchBytes: vcard text on its way to sink at most, 0 for no limit
+ * @skip         : hrefs not to download again, i.e. of an interrupted sync
+ * @known        : validators of the cards of the previous cache, these cards are
+ *                 only downloaded if they changed, see CardSink::keepCards
+ *
+ * @return: FALSE if libcurl is missing, the sink failed or the listing or
+ *          a card could not be downloaded even after retrying, TRUE otherwise
+ */
+bool CardCurler::getAllCards(const std::string &server, const std::string &query, CardSink *sink, size_t maxBatchBytes, const std::set<std::string> *skip, const std::map<std::string, CardValidators> *known) {
+    StatsTimer timer("CardCurler::getAllCards");
 
-        std::string auth(_username + ":" + _password);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-        curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-        curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
-        curl_easy_setopt(curl, CURLOPT_HEADER, 0L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CardCurler::writeFunc);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &card);
-
-        //int j = 0;
-        for(unsigned int i=0; i < cardUrls.size(); i++) {
-            std::stringstream ss;
-            std::string url(cardUrls.at(i));
-            ss << server << url;
+    if(Option::isVerbose()) {
+        std::cout << "CardCurler::getAllCards called. Server: " << server << std::endl;
+        std::cout << "CardCurler::getAllCards called. Query: " << query << std::endl;
+    }
 
-            if(Option::isVerbose()) {
-                std::cout << "Curling url " << ss.str() << std::endl;
-            }
+    const CurlApi* lib = CurlLib::get();
+    if(lib == NULL)
+        return false;
 
-            curl_easy_setopt(curl, CURLOPT_URL, ss.str().c_str());
-            res = curl_easy_perform(curl);
+    exportMode = true;
 
-            if(res != CURLE_OK) {
-                std::cerr << "CardCurler::getVCard() failed on URL: "
-                     << url
-                     << ", Code: "
-                     << curl_easy_strerror(res) << endl;
+    std::vector< std::string > cardUrls;
+    if(false == getvCardURLs(query, &cardUrls))
+        return false;
 
-                break;
-            }
+    bool ok = true;
+    long numCards = 0;
 
-            // if(Option::isVerbose()) {
-            //     std::cerr << "TRACE: " << "Card size: " << card.size() << " chars" << std::endl;
-            //     std::cerr << card << std::endl;
-            // }
-
-            if(card.size() > 0) {
-                std::vector<vCard> cards = vCard::fromString(card);
-                if(cards.size() == 1) {
-                    Person p;
-                    createPerson(&cards[0], &p);
-                    if(p.isValid()) {
-                        std::cout << "fetched valid vcard from: " << server << url << endl;
-                        p.rawCardData = card;
-                        persons.push_back(p);
-                        //j++;
-                    }
-                }
+    if(Option::isVerbose()) {
+        std::cout << "Number of card urls: " << cardUrls.size() << std::endl;
+    }
 
-                card = "";
-            }
+    if(skip && skip->size() > 0) {
+        std::vector<std::string> remaining;
+        for(unsigned int i=0; i<cardUrls.size(); i++) {
+            if(skip->count(cardUrls.at(i)) == 0)
+                remaining.push_back(cardUrls.at(i));
+        }
+        std::cout << "Skipping " << cardUrls.size() - remaining.size() << " cards downloaded before" << std::endl;
+        cardUrls.swap(remaining);
+    }
+
+    // the first connection is the one the PROPFIND went over
+    std::vector<CURL*> handles;
+    CURL* curl = handle();
+    unsigned int connections = cardUrls.size() < SYNC_CONNECTIONS ? cardUrls.size() : SYNC_CONNECTIONS;
+    for(unsigned int c=0; curl && c<connections; c++) {
+        CURL* h = (c == 0) ? curl : lib->easy_init();
+        if(h == NULL)
+            break;
+        handles.push_back(h);
+    }
 
-            //if(j>12) break;
+    if(handles.size() > 0) {
+        std::string auth(_username + ":" + _password);
+        for(unsigned int c=0; c<handles.size(); c++) {
+            CURL* h = handles.at(c);
+            lib->easy_setopt(h, CURLOPT_VERBOSE, Option::isVerbose() ? 1L : 0L);
+            lib->easy_setopt(h, CURLOPT_SSL_VERIFYPEER, 0L);
+            lib->easy_setopt(h, CURLOPT_SSL_VERIFYHOST, 0L);
+            lib->easy_setopt(h, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+            lib->easy_setopt(h, CURLOPT_USERPWD, auth.c_str());
+            lib->easy_setopt(h, CURLOPT_HEADER, 0L);
+            lib->easy_setopt(h, CURLOPT_WRITEFUNCTION, &CardCurler::writeFunc);
         }
 
-        /* always cleanup */
-        curl_easy_cleanup(curl);
+        CardDownloader downloader(server, _section, cardUrls, handles, known);
+        SyncPipeline pipeline(sink, maxBatchBytes);
+        ok = pipeline.run(cardUrls.size(), handles.size(), &downloader);
+        pipeline.report(_section);
+        numCards = pipeline.cards();
+        CurlMetrics::addWallTime(_section, pipeline.seconds());
 
+        for(unsigned int c=1; c<handles.size(); c++)
+            lib->easy_cleanup(handles.at(c));
     }
 
-    curl_global_cleanup();
-    return persons;
+    CurlMetrics::addCards(_section, numCards);
+    return ok;
 }
 
 /*
@@ -314,9 +568,17 @@ bool CardCurler::listContainsQuery(const std::vector<string> *list, const string
     return false;
 }
 
-// get server resource using libcurl
-std::string CardCurler::get(const string &requestType, const std::string& query) {
-    std::string result;
+// get server resource using libcurl. Like the downloads of a sync a request
+// that failed on the way or with 429 or 5xx is tried again up to retries times
+//
+// @return: TRUE if the server answered with 207 Multi-Status, FALSE otherwise
+bool CardCurler::get(const string &requestType, const std::string& query, std::string* result, int depth, int retries) {
+    StatsTimer timer("CardCurler::get");
+    result->clear();
+
+    const CurlApi* lib = CurlLib::get();
+    if(lib == NULL)
+        return false;
 
     // prepare the data structure from which curl reads the query which is then send to the peer
     char *data = (char *)(query.c_str());
@@ -325,58 +587,74 @@ std::string CardCurler::get(const string &requestType, const std::string& query)
     pdata.body_size = strlen(data);
     pdata.data = data;
 
-    CURL *curl;
-    CURLcode res;
-
-    curl_global_init(CURL_GLOBAL_DEFAULT);
-    curl = curl_easy_init();
+    CURL* curl = handle();
+    bool ok = false;
 
     if(curl) {
         struct curl_slist *headers = NULL;
-        headers = curl_slist_append(headers, "Depth: 1");
-        headers = curl_slist_append(headers, "Content-Type: text/xml; charset=utf-8");
+        headers = lib->slist_append(headers, depth == 0 ? "Depth: 0" : "Depth: 1");
+        headers = lib->slist_append(headers, "Content-Type: text/xml; charset=utf-8");
 
         std::string auth(_username + ":" + _password);
-        curl_easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
-        curl_easy_setopt(curl, CURLOPT_URL, _url.c_str());
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
-        curl_easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
-        curl_easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
-        curl_easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
-        curl_easy_setopt(curl, CURLOPT_CUSTOMREQUEST, requestType.c_str());
-
-        curl_easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)pdata.body_size);
-        curl_easy_setopt(curl, CURLOPT_READDATA, &pdata);
-        curl_easy_setopt(curl, CURLOPT_READFUNCTION, &CardCurler::readFunc);
-        curl_easy_setopt(curl, CURLOPT_UPLOAD, 1L);
-        curl_easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CardCurler::writeFunc);
-        curl_easy_setopt(curl, CURLOPT_WRITEDATA, &result);
+        lib->easy_setopt(curl, CURLOPT_HTTPHEADER, headers);
+        lib->easy_setopt(curl, CURLOPT_URL, _url.c_str());
+        lib->easy_setopt(curl, CURLOPT_SSL_VERIFYPEER, 0L);
+        lib->easy_setopt(curl, CURLOPT_SSL_VERIFYHOST, 0L);
+        lib->easy_setopt(curl, CURLOPT_HTTPAUTH, CURLAUTH_BASIC);
+        lib->easy_setopt(curl, CURLOPT_USERPWD, auth.c_str());
+        lib->easy_setopt(curl, CURLOPT_CUSTOMREQUEST, requestType.c_str());
+
+        lib->easy_setopt(curl, CURLOPT_INFILESIZE_LARGE, (curl_off_t)pdata.body_size);
+        lib->easy_setopt(curl, CURLOPT_READDATA, &pdata);
+        lib->easy_setopt(curl, CURLOPT_READFUNCTION, &CardCurler::readFunc);
+        lib->easy_setopt(curl, CURLOPT_UPLOAD, 1L);
+        lib->easy_setopt(curl, CURLOPT_WRITEFUNCTION, &CardCurler::writeFunc);
+        lib->easy_setopt(curl, CURLOPT_WRITEDATA, result);
 
         if(Option::isVerbose()) {
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 1L);
+            lib->easy_setopt(curl, CURLOPT_VERBOSE, 1L);
         } else {
-            curl_easy_setopt(curl, CURLOPT_VERBOSE, 0L);
+            lib->easy_setopt(curl, CURLOPT_VERBOSE, 0L);
         }
 
-        res = curl_easy_perform(curl);
-        if(res != CURLE_OK) {
-            std::cerr << "CURL Error. Code: " << res << std::endl;
-        }
+        for(int attempt=0; ; attempt++) {
+            pdata.body_pos = 0;
+            result->clear();
+            res = lib->easy_perform(curl);
+            CurlMetrics::record(_section, curl);
 
-        curl_easy_cleanup(curl);
-    }
+            long status = 0;
+            if(res == CURLE_OK)
+                lib->easy_getinfo(curl, CURLINFO_RESPONSE_CODE, &status);
 
-    curl_global_cleanup();
-    return result;
-}
+            if(status == 207) {
+                ok = true;
+                break;
+            }
 
-std::vector<Person> CardCurler::curlCache(const std::string &query) {
-    if(Option::isVerbose()) {
-        std::cout << "Curling cache using query '" << query << "'";
+            std::stringstream reason;
+            if(res != CURLE_OK)
+                reason << lib->easy_strerror(res);
+            else
+                reason << "HTTP " << status;
+
+            bool transient = res != CURLE_OK || status == 429 || status >= 500;
+            if(false == transient || attempt >= retries) {
+                std::cerr << "CURL Error. " << requestType << " on " << _url << " failed, Code: " << reason.str() << std::endl;
+                result->clear();
+                break;
+            }
+
+            int delay = SYNC_RETRY_DELAY_MS << attempt;
+            std::cerr << requestType << " on " << _url << " failed (" << reason.str() << "), retrying in " << delay << " ms" << std::endl;
+            Stats::count("sync_retries");
+            std::this_thread::sleep_for(std::chrono::milliseconds(delay));
+        }
+
+        lib->slist_free_all(headers);
     }
 
-    Cache cache;
-    return cache.findInCache(query);
+    return ok;
 }
 
 // curl a card online
@@ -386,17 +664,44 @@ std::vector<Person> CardCurler::curlCache(const std::string &query) {
 // where the contents of the query file matches
 // https://datatracker.ietf.org/doc/html/rfc6352#section-8.6.4
 std::vector<Person> CardCurler::curlCard(const std::string &query) {
+    StatsTimer timer("CardCurler::curlCard");
 
     // Result
     std::vector<Person> people;
 
-    // execute the query!
-    std::string http_result = get("REPORT", query);
+    // execute the query! a search is not retried, mutt waits for it
+    std::string http_result;
+    get("REPORT", query, &http_result);
 
     if(Option::isVerbose()) {
         cout << "TRACE: " << "querying via func curlCard. Query is:" << query << endl;
     }
 
+    people = parseAddressData(http_result);
+    CurlMetrics::addCards(_section, people.size());
+    if(people.size() == 0 && Option::isVerbose()) {
+        cout << "TRACE: " << "no vcard data found in REPORT response" << endl;
+    }
+
+    return people;
+}
+
+static void removeCarriageReturns(std::string* data) {
+    StringUtils::replace(data, "&#13;", "");
+}
+
+/*
+ * Extracts the vcards from the address-data elements of a REPORT response.
+ * The namespace prefix of address-data tells us which server we talk to.
+ *
+ * @response: the raw REPORT response body
+ * @return  : a vector of all valid Persons found
+ */
+std::vector<Person> CardCurler::parseAddressData(const std::string &response) {
+    std::vector<Person> people;
+    const std::string& http_result = response;
+    bool isSOGO = false;
+
     std::string vcardAddressBeginToken = "<card:address-data>"; // defaults to Owncloud
     std::string vcardAddressEndToken = "</card:address-data>";
 
@@ -421,47 +726,23 @@ std::vector<Person> CardCurler::curlCard(const std::string &query) {
         vcardAddressEndToken   = "</ns1:address-data>";
     }
 
+    std::vector<std::string> chunks;
     std::vector<std::string> list = StringUtils::split(http_result, vcardAddressBeginToken);
-    if(list.size() > 0) {
-        for(unsigned int i=1; i<list.size(); i++) {
-
-            if(Option::isVerbose()) {
-                cout << list.at(i) << endl;
-            }
-
-            std::vector<std::string> _list = StringUtils::split(list.at(i), vcardAddressEndToken);
-            // _list contains 2 elements where the first element is a single vcard
-            if(_list.size() == 2) {
-
-                std::string s = _list.at(0);
-                StringUtils::replace(&s, "&#13;", "");
-
-                if(isSOGO)
-                    fixHtml(&s);
-
-                std::vector<vCard> vcards = vCard::fromString(s);
+    for(unsigned int i=1; i<list.size(); i++) {
 
-                if(vcards.size() > 0) {
-                    for(unsigned int j = 0; j < vcards.size(); j++) {
-                        // there is only one vcard in the list - every time ;)
-                        Person p;
-                        vCard c = vcards.at(j);
-                        createPerson(&c, &p);
+        if(Option::isVerbose()) {
+            cout << list.at(i) << endl;
+        }
 
-                        if(p.isValid()) {
-                            p.rawCardData = s;
-                            people.push_back(p);
-                        }
-                    }
-                }
-            }
+        std::vector<std::string> _list = StringUtils::split(list.at(i), vcardAddressEndToken);
+        // _list contains 2 elements where the first element is a single vcard
+        if(_list.size() == 2) {
+            chunks.push_back(_list.at(0));
         }
     }
-    else
-    {
-        cout << "failed to get vcard data. code: " << res << endl;
-    }
 
+    // entities are decoded by the parser threads, there is only one vcard per chunk - every time ;)
+    people = ParallelParser::parse(chunks, isSOGO ? &CardCurler::fixHtml : &removeCarriageReturns);
     return people;
 }
 
@@ -586,6 +867,7 @@ size_t CardCurler::writeFunc(void *buffer, size_t size, size_t nmemb, void *user
     // that we receive in *buffer
     std::string * pbuf = static_cast<std::string *>(userp);
     pbuf->append(static_cast<const char *>(buffer), size * nmemb);
+    Stats::count("bytes_received", size * nmemb);
     return size * nmemb;
 }
 
@@ -30,6 +30,8 @@
 #include <sys/stat.h>
 #include <fcntl.h>
 #include <vector>
+#include <set>
+#include <map>
 
 //#include <vcard/vcard.h>
 #include "person.h"
@@ -38,13 +40,46 @@
 
 using namespace std;
 
+// the cards a sync is cut into are downloaded and parsed at most this many at a time
+#define SYNC_BATCH_CARDS 256
+
+// Receives the cards of CardCurler::getAllCards one batch at a time,
+// the batch is freed as soon as addCards returns.
+class CardSink
+{
+public:
+    virtual ~CardSink() {}
+
+    // returning false stops the download
+    virtual bool addCards(std::vector<Person>& people) = 0;
+
+    // the cards of these hrefs did not change since the validators passed to
+    // getAllCards were taken. Returns the number of cards kept, -1 stops the download
+    virtual int keepCards(const std::vector<std::string>& hrefs) = 0;
+};
+
 class CardCurler
 {
 public:
     CardCurler(const std::string &username, const std::string &password, const std::string &url, const std::string &rawQuery);
+    ~CardCurler();
     std::vector<Person> curlCard(const std::string &query);
-    static std::vector<Person> curlCache(const std::string &query); // query should be the raw query string as we dont query the server
     std::vector<Person> getAllCards(const std::string &server, const std::string &query);
+    bool getAllCards(const std::string &server, const std::string &query, CardSink* sink, size_t maxBatchBytes = 0, const std::set<std::string>* skip = NULL, const std::map<std::string, CardValidators>* known = NULL);
+
+    // the ctag of the collection, empty if the server has none. query should ask for CS:getctag.
+    // FALSE if the server could not be asked
+    bool getCTag(const std::string &query, std::string* ctag);
+
+    // the config section the transfer metrics are reported for
+    void setSection(const std::string &section);
+
+    // response parsing, independent of any connection
+    static std::vector<std::string> parseHrefs(const std::string &response);
+    static std::string parseCTag(const std::string &response);
+    static std::vector<Person> parseAddressData(const std::string &response);
+    static void fixHtml(string *data);
+    static void createPerson(const vCard *vcdata, Person *p);
 
 private:
 
@@ -56,25 +91,26 @@ private:
         int body_pos;
     } postdata;
 
+    // kept for the lifetime of the curler, so its connection can be reused
     CURL *curl;
     CURLcode res;
 
+    CURL* handle();
+    CardCurler(const CardCurler&);
+    CardCurler& operator=(const CardCurler&);
+
     // if this becomes TRUE, createPerson will not
     // use _rawQuery to remove unwanted emails
     bool exportMode;
 
-    // indicates SOGO if TRUE
-    bool isSOGO;
-
     std::string _url;
     std::string _username;
     std::string _password;
     std::string _rawQuery;
+    std::string _section;
 
-    std::string get(const std::string& requestType, const std::string &query = std::string());
-    std::vector< std::string > getvCardURLs(const std::string &query);
-    void fixHtml(string *data);
-    void createPerson(const vCard *vcdata, Person *p);
+    bool get(const std::string& requestType, const std::string &query, std::string* result, int depth = 1, int retries = 0);
+    bool getvCardURLs(const std::string &query, std::vector<std::string>* urls);
     bool listContainsQuery(const std::vector<std::string> *list, const std::string &query);
     static size_t writeFunc(void *buffer, size_t size, size_t nmemb, void *userp);
     static size_t readFunc(void *buffer, size_t size, size_t nmemb, void *userp);
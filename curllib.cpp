@@ -0,0 +1,81 @@
+#include "curllib.h"
+#include "stats.h"
+#include <iostream>
+
+#ifdef LAZY_CURL
+#include <dlfcn.h>
+
+static const char* const LIBRARY_NAMES[] = {
+    "libcurl.so.4", "libcurl.so", "libcurl.4.dylib", "libcurl.dylib", NULL
+};
+
+template <typename T>
+static bool resolve(void* handle, const char* name, T* fn) {
+    *fn = reinterpret_cast<T>(dlsym(handle, name));
+    if(*fn == NULL) {
+        std::cerr << "Can't find " << name << " in libcurl: " << dlerror() << std::endl;
+        return false;
+    }
+    return true;
+}
+
+static bool load(CurlApi* api) {
+    StatsTimer timer("CurlLib::load");
+
+    void* handle = NULL;
+    for(int i=0; LIBRARY_NAMES[i] && handle == NULL; i++)
+        handle = dlopen(LIBRARY_NAMES[i], RTLD_NOW | RTLD_LOCAL);
+
+    if(handle == NULL) {
+        std::cerr << "Can't load libcurl: " << dlerror() << std::endl;
+        return false;
+    }
+
+    // the library stays loaded until the process exits
+    return resolve(handle, "curl_global_init", &api->global_init)
+            && resolve(handle, "curl_global_cleanup", &api->global_cleanup)
+            && resolve(handle, "curl_easy_init", &api->easy_init)
+            && resolve(handle, "curl_easy_setopt", &api->easy_setopt)
+            && resolve(handle, "curl_easy_perform", &api->easy_perform)
+            && resolve(handle, "curl_easy_getinfo", &api->easy_getinfo)
+            && resolve(handle, "curl_easy_cleanup", &api->easy_cleanup)
+            && resolve(handle, "curl_easy_reset", &api->easy_reset)
+            && resolve(handle, "curl_easy_strerror", &api->easy_strerror)
+            && resolve(handle, "curl_slist_append", &api->slist_append)
+            && resolve(handle, "curl_slist_free_all", &api->slist_free_all);
+}
+#else
+static bool load(CurlApi* api) {
+    api->global_init = &curl_global_init;
+    api->global_cleanup = &curl_global_cleanup;
+    api->easy_init = &curl_easy_init;
+    api->easy_setopt = &curl_easy_setopt;
+    api->easy_perform = &curl_easy_perform;
+    api->easy_getinfo = &curl_easy_getinfo;
+    api->easy_cleanup = &curl_easy_cleanup;
+    api->easy_reset = &curl_easy_reset;
+    api->easy_strerror = &curl_easy_strerror;
+    api->slist_append = &curl_slist_append;
+    api->slist_free_all = &curl_slist_free_all;
+    return true;
+}
+#endif
+
+static bool init(CurlApi* api) {
+    if(false == load(api))
+        return false;
+
+    // once per process, not per request
+    if(CURLE_OK != api->global_init(CURL_GLOBAL_DEFAULT)) {
+        std::cerr << "Can't initialize libcurl" << std::endl;
+        return false;
+    }
+
+    return true;
+}
+
+const CurlApi* CurlLib::get() {
+    static CurlApi api;
+    static bool loaded = init(&api);
+    return loaded ? &api : NULL;
+}
@@ -0,0 +1,34 @@
+#ifndef CURLLIB_H
+#define CURLLIB_H
+
+#include <curl/curl.h>
+
+// the subset of libcurl we use
+struct CurlApi
+{
+    CURLcode (*global_init)(long flags);
+    void (*global_cleanup)(void);
+    CURL* (*easy_init)(void);
+    CURLcode (*easy_setopt)(CURL* curl, CURLoption option, ...);
+    CURLcode (*easy_perform)(CURL* curl);
+    CURLcode (*easy_getinfo)(CURL* curl, CURLINFO info, ...);
+    void (*easy_cleanup)(CURL* curl);
+    void (*easy_reset)(CURL* curl);
+    const char* (*easy_strerror)(CURLcode code);
+    struct curl_slist* (*slist_append)(struct curl_slist* list, const char* string);
+    void (*slist_free_all)(struct curl_slist* list);
+};
+
+// Loading libcurl and its TLS stack takes several milliseconds at startup,
+// which a search answered from the cache never needs. Built with LAZY_CURL
+// the library is dlopen()ed on first use, otherwise the table points at the
+// linked functions.
+class CurlLib
+{
+public:
+    // NULL if libcurl can't be loaded, the reason was printed already.
+    // curl_global_init has been called once the table is returned
+    static const CurlApi* get();
+};
+
+#endif // CURLLIB_H
@@ -0,0 +1,179 @@
+#include "curlmetrics.h"
+#include "curllib.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <algorithm>
+#include <map>
+#include <vector>
+#include <mutex>
+
+namespace {
+
+// one entry per request, all times in seconds since the request started
+struct SectionMetrics
+{
+    std::vector<double> namelookup;
+    std::vector<double> connect;
+    std::vector<double> appconnect;
+    std::vector<double> starttransfer;
+    std::vector<double> total;
+    double bytes;
+    double wallTime;
+    long newConnections;
+    long cards;
+    std::map<std::string, long> httpVersions;
+};
+
+std::mutex metricsMutex;
+std::vector<std::string> order; // sections in the order they were first seen
+std::map<std::string, SectionMetrics> metrics;
+
+SectionMetrics& section(const std::string& name) {
+    std::map<std::string, SectionMetrics>::iterator it = metrics.find(name);
+    if(it == metrics.end()) {
+        SectionMetrics m;
+        m.bytes = 0;
+        m.wallTime = 0;
+        m.newConnections = 0;
+        m.cards = 0;
+        it = metrics.insert(std::make_pair(name, m)).first;
+        order.push_back(name);
+    }
+    return it->second;
+}
+
+std::string httpVersion(long version) {
+    switch(version) {
+    case CURL_HTTP_VERSION_1_0: return "http/1.0";
+    case CURL_HTTP_VERSION_1_1: return "http/1.1";
+    case CURL_HTTP_VERSION_2_0: return "http/2";
+#ifdef CURL_HTTP_VERSION_3
+    case CURL_HTTP_VERSION_3: return "http/3";
+#endif
+    default: return "unknown";
+    }
+}
+
+double percentile(std::vector<double> values, double p) {
+    if(values.size() == 0)
+        return 0;
+
+    std::sort(values.begin(), values.end());
+    size_t index = (size_t)(p * (values.size() - 1) + 0.5);
+    return values.at(index);
+}
+
+double sum(const std::vector<double>& values) {
+    double result = 0;
+    for(unsigned int i=0; i<values.size(); i++)
+        result += values.at(i);
+    return result;
+}
+
+void printRow(std::ostream& out, const std::string& name, const std::vector<double>& values) {
+    out << "  " << std::left << std::setw(14) << name << std::right
+        << std::setw(10) << percentile(values, 0.50) * 1000
+        << std::setw(10) << percentile(values, 0.95) * 1000 << std::endl;
+}
+
+}
+
+void CurlMetrics::record(const std::string &name, CURL *curl, bool concurrent) {
+    double namelookup = 0, connect = 0, appconnect = 0, starttransfer = 0, total = 0;
+    curl_off_t bytes = 0;
+    long version = 0, connects = 0;
+
+    const CurlApi* lib = CurlLib::get();
+    if(lib == NULL)
+        return;
+
+    lib->easy_getinfo(curl, CURLINFO_NAMELOOKUP_TIME, &namelookup);
+    lib->easy_getinfo(curl, CURLINFO_CONNECT_TIME, &connect);
+    lib->easy_getinfo(curl, CURLINFO_APPCONNECT_TIME, &appconnect);
+    lib->easy_getinfo(curl, CURLINFO_STARTTRANSFER_TIME, &starttransfer);
+    lib->easy_getinfo(curl, CURLINFO_TOTAL_TIME, &total);
+    lib->easy_getinfo(curl, CURLINFO_SIZE_DOWNLOAD_T, &bytes);
+    lib->easy_getinfo(curl, CURLINFO_HTTP_VERSION, &version);
+    lib->easy_getinfo(curl, CURLINFO_NUM_CONNECTS, &connects);
+
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    SectionMetrics& m = section(name);
+    m.namelookup.push_back(namelookup);
+    m.connect.push_back(connect);
+    m.appconnect.push_back(appconnect);
+    m.starttransfer.push_back(starttransfer);
+    m.total.push_back(total);
+    m.bytes += bytes;
+    m.newConnections += connects;
+    m.httpVersions[httpVersion(version)]++;
+    if(false == concurrent)
+        m.wallTime += total;
+}
+
+void CurlMetrics::addWallTime(const std::string &name, double seconds) {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    section(name).wallTime += seconds;
+}
+
+void CurlMetrics::addCards(const std::string &name, long cards) {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    section(name).cards += cards;
+}
+
+bool CurlMetrics::hasData() {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    return metrics.size() > 0;
+}
+
+void CurlMetrics::report() {
+    std::lock_guard<std::mutex> lock(metricsMutex);
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(2);
+
+    for(unsigned int i=0; i<order.size(); i++) {
+        const SectionMetrics& m = metrics[order.at(i)];
+        long requests = m.total.size();
+
+        ss << "---- transfers [" << order.at(i) << "] ----" << std::endl;
+        ss << "  requests " << requests << ", new connections " << m.newConnections
+           << ", reused " << std::max(0L, requests - m.newConnections);
+        for(std::map<std::string, long>::const_iterator it = m.httpVersions.begin(); it != m.httpVersions.end(); ++it)
+            ss << ", " << it->first << " " << it->second;
+        ss << std::endl;
+
+        ss << "  " << std::left << std::setw(14) << "ms" << std::right << std::setw(10) << "p50" << std::setw(10) << "p95" << std::endl;
+        printRow(ss, "dns", m.namelookup);
+        printRow(ss, "connect", m.connect);
+        printRow(ss, "tls", m.appconnect);
+        printRow(ss, "first byte", m.starttransfer);
+        printRow(ss, "total", m.total);
+
+        double seconds = m.wallTime;
+        ss << "  downloaded " << (long)m.bytes << " bytes";
+        if(seconds > 0) {
+            ss << ", " << m.bytes / 1024 / seconds << " KiB/s";
+            if(m.cards > 0)
+                ss << ", " << m.cards << " cards, " << m.cards / seconds << " cards/s";
+        }
+        ss << std::endl;
+
+        // where did the time go: connection setup, waiting for the server, receiving the body.
+        // Shares of the time of all requests, which overlap when they run concurrently
+        double requestTime = sum(m.total);
+        double setup = 0, server = 0, transfer = 0;
+        for(long r=0; r<requests; r++) {
+            double connected = std::max(m.connect.at(r), m.appconnect.at(r));
+            setup += connected;
+            server += std::max(0.0, m.starttransfer.at(r) - connected);
+            transfer += std::max(0.0, m.total.at(r) - m.starttransfer.at(r));
+        }
+        if(requestTime > 0) {
+            ss << std::setprecision(0) << "  time split: connect " << setup * 100 / requestTime << "%, server "
+               << server * 100 / requestTime << "%, transfer " << transfer * 100 / requestTime << "%" << std::endl;
+            ss << std::setprecision(2);
+        }
+    }
+
+    std::cerr << ss.str();
+}
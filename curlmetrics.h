@@ -0,0 +1,24 @@
+#ifndef CURLMETRICS_H
+#define CURLMETRICS_H
+
+#include <string>
+#include <curl/curl.h>
+
+// Keeps what libcurl knows about every finished transfer, grouped by
+// config section. The summary splits the time into connection setup,
+// server think time and the transfer itself, which tells whether a slow
+// sync is bound by the round trip time, the server or the bandwidth.
+// Rates are taken over the wall time of a section: sequential requests
+// add their own time, concurrent ones the time their batch took as a whole.
+class CurlMetrics
+{
+public:
+    // concurrent requests leave the wall time to addWallTime
+    static void record(const std::string& section, CURL* curl, bool concurrent = false);
+    static void addWallTime(const std::string& section, double seconds);
+    static void addCards(const std::string& section, long cards);
+    static bool hasData();
+    static void report();
+};
+
+#endif // CURLMETRICS_H
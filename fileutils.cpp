@@ -84,6 +84,53 @@ bool FileUtils::putFileContent(const std::string& path, const std::string &conte
     return true;
 }
 
+// Writes content to a temporary file next to path and renames it over path,
+// so readers see either the old or the new file. Nothing is written when
+// path already has this content. The temporary name is unique, two runs
+// writing the same file don't write into each other's
+bool FileUtils::replaceFileContent(const std::string &path, const std::string &content, bool *changed) {
+    if(changed) *changed = false;
+
+    if(fileExists(path)) {
+        std::ifstream s(path.c_str());
+        std::stringstream buf;
+        buf << s.rdbuf();
+        if(buf.str() == content)
+            return true;
+    }
+
+    // mkstemp creates the file readable by the owner only
+    std::string tmp = path + ".XXXXXX";
+    int fd = mkstemp(&tmp[0]);
+    if(fd < 0) {
+        cerr << "Cant write to file '" << path << "' Unable to create a temporary file!" << endl;
+        return false;
+    }
+
+    size_t written = 0;
+    while(written < content.size()) {
+        ssize_t n = write(fd, content.data() + written, content.size() - written);
+        if(n <= 0)
+            break;
+        written += n;
+    }
+
+    if(close(fd) != 0 || written < content.size()) {
+        cerr << "Cant write to file '" << tmp << "'" << endl;
+        fileRemove(tmp);
+        return false;
+    }
+
+    if(rename(tmp.c_str(), path.c_str()) != 0) {
+        cerr << "Cant move '" << tmp << "' to '" << path << "'" << endl;
+        fileRemove(tmp);
+        return false;
+    }
+
+    if(changed) *changed = true;
+    return true;
+}
+
 std::string FileUtils::getHomeDir() {
     struct passwd *pw = getpwuid(getuid());
     std::string d1(pw->pw_dir);
@@ -44,6 +44,7 @@ public:
     static bool fileRemove(const std::string& file);
     static bool dirExists(const std::string& dir);
     static bool putFileContent(const std::string& path, const std::string &content);
+    static bool replaceFileContent(const std::string& path, const std::string &content, bool *changed = NULL);
     static bool getFileContent(const std::string& path, std::string *buffer);
     static std::string getHomeDir();
 };
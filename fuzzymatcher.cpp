@@ -0,0 +1,132 @@
+#include "fuzzymatcher.h"
+#include <algorithm>
+#include <stdlib.h>
+#include <ctype.h>
+
+// terms shorter than this are neither indexed nor searched
+#define MIN_TERM_LENGTH 3
+
+// ascii spelling of U+00C0 to U+00FF, the second byte of the utf-8 sequence minus 0x80
+static const char* const LATIN1_FOLDS[] = {
+    "a", "a", "a", "a", "ae", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "oe", " ", "o", "u", "u", "u", "ue", "y", "th", "ss",
+    "a", "a", "a", "a", "ae", "a", "ae", "c", "e", "e", "e", "e", "i", "i", "i", "i",
+    "d", "n", "o", "o", "o", "o", "oe", " ", "o", "u", "u", "u", "ue", "y", "th", "y"
+};
+
+std::string FuzzyMatcher::fold(const std::string &text) {
+    std::string result;
+    result.reserve(text.size());
+    for(size_t i=0; i<text.size(); i++) {
+        unsigned char c = text[i];
+        if(c < 0x80) {
+            result += tolower(c);
+        } else if(c == 0xC3 && i + 1 < text.size() && ((unsigned char)text[i+1] & 0xC0) == 0x80) {
+            result += LATIN1_FOLDS[((unsigned char)text[i+1] & 0x3F)];
+            i++;
+        } else {
+            result += c;
+        }
+    }
+    return result;
+}
+
+// splits at everything but letters and digits, bytes of other utf-8
+// characters are kept. Terms made of digits only are dropped
+std::vector<std::string> FuzzyMatcher::terms(const std::string &text, bool localPartOnly) {
+    std::string folded = fold(localPartOnly ? text.substr(0, text.find('@')) : text);
+    std::vector<std::string> result;
+
+    std::string term;
+    bool digitsOnly = true;
+    for(size_t i=0; i<=folded.size(); i++) {
+        unsigned char c = i < folded.size() ? folded[i] : ' ';
+        if(isalnum(c) || c >= 0x80) {
+            term += c;
+            digitsOnly = digitsOnly && isdigit(c);
+            continue;
+        }
+
+        if(term.size() >= MIN_TERM_LENGTH && false == digitsOnly)
+            result.push_back(term);
+        term.clear();
+        digitsOnly = true;
+    }
+    return result;
+}
+
+// the distinct terms of a card
+std::vector<std::string> FuzzyMatcher::cardTerms(const std::string &fn, const std::string &ln, const std::vector<std::string> &emails) {
+    std::vector<std::string> result = terms(fn);
+    std::vector<std::string> more = terms(ln);
+    result.insert(result.end(), more.begin(), more.end());
+
+    for(unsigned int i=0; i<emails.size(); i++) {
+        more = terms(emails.at(i), true);
+        result.insert(result.end(), more.begin(), more.end());
+    }
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// trigrams of the term with its start and end marked, "^jo", "joh", "ohn", "hn$"
+std::vector<std::string> FuzzyMatcher::grams(const std::string &term) {
+    std::string padded = "^" + term + "$";
+    std::vector<std::string> result;
+    for(size_t i=0; i+3<=padded.size(); i++)
+        result.push_back(padded.substr(i, 3));
+
+    std::sort(result.begin(), result.end());
+    result.erase(std::unique(result.begin(), result.end()), result.end());
+    return result;
+}
+
+// short terms must match exactly, everything else may have one typo,
+// long terms two
+int FuzzyMatcher::maxDistance(const std::string &term) {
+    if(term.size() <= 3)
+        return 0;
+    return term.size() < 8 ? 1 : 2;
+}
+
+// a single edit, a swap included, touches at most four trigrams
+int FuzzyMatcher::minSharedGrams(const std::string &term) {
+    int shared = (int)grams(term).size() - 4 * maxDistance(term);
+    return shared > 0 ? shared : 1;
+}
+
+// optimal string alignment distance, gives up and returns max + 1 as soon
+// as the distance is known to be larger than max
+int FuzzyMatcher::distance(const std::string &a, const std::string &b, int max) {
+    int n = a.size();
+    int m = b.size();
+    if(abs(n - m) > max)
+        return max + 1;
+
+    std::vector<int> before(m + 1), previous(m + 1), current(m + 1);
+    for(int j=0; j<=m; j++)
+        previous[j] = j;
+
+    for(int i=1; i<=n; i++) {
+        current[0] = i;
+        int rowMin = current[0];
+        for(int j=1; j<=m; j++) {
+            int cost = a[i-1] == b[j-1] ? 0 : 1;
+            int d = std::min(std::min(previous[j] + 1, current[j-1] + 1), previous[j-1] + cost);
+            if(i > 1 && j > 1 && a[i-1] == b[j-2] && a[i-2] == b[j-1])
+                d = std::min(d, before[j-2] + 1);
+            current[j] = d;
+            rowMin = std::min(rowMin, d);
+        }
+
+        if(rowMin > max)
+            return max + 1;
+
+        before.swap(previous);
+        previous.swap(current);
+    }
+
+    return std::min(previous[m], max + 1);
+}
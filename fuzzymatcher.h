@@ -0,0 +1,26 @@
+#ifndef FUZZYMATCHER_H
+#define FUZZYMATCHER_H
+
+#include <string>
+#include <vector>
+
+// The text side of the typo tolerant cache search. Names and the local
+// part of addresses are split into terms, folded to plain lower case
+// ascii where possible ("Müller" becomes "mueller"), and each term is
+// indexed by its trigrams. A query term is compared against the terms
+// sharing enough trigrams with it using a bounded edit distance that
+// counts a swap of two neighbouring letters as one edit.
+class FuzzyMatcher
+{
+public:
+    static std::string fold(const std::string& text);
+    static std::vector<std::string> terms(const std::string& text, bool localPartOnly = false);
+    static std::vector<std::string> cardTerms(const std::string& fn, const std::string& ln, const std::vector<std::string>& emails);
+    static std::vector<std::string> grams(const std::string& term);
+
+    static int maxDistance(const std::string& term);
+    static int minSharedGrams(const std::string& term);
+    static int distance(const std::string& a, const std::string& b, int max);
+};
+
+#endif // FUZZYMATCHER_H
@@ -0,0 +1,310 @@
+#include "localsource.h"
+#include "parallelparser.h"
+#include "stats.h"
+#include "option.h"
+#include <map>
+#include <set>
+#include <dirent.h>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <strings.h>
+
+// vdirsyncer puts one collection per subdirectory, there is no need to go deeper
+#define MAX_VDIR_DEPTH 1
+
+LocalSource::LocalSource(const std::string &section, const std::string &path)
+{
+    this->section = section;
+
+    // ~/contacts is the way people write it into the config
+    if(path.compare(0, 2, "~/") == 0)
+        root = FileUtils::getHomeDir() + path.substr(1);
+    else
+        root = path;
+
+    while(root.size() > 1 && root[root.size() - 1] == '/')
+        root.erase(root.size() - 1);
+}
+
+const std::string& LocalSource::path() const {
+    return root;
+}
+
+bool LocalSource::isVcf(const std::string &name) {
+    return name.size() > 4 && strcasecmp(name.c_str() + name.size() - 4, ".vcf") == 0;
+}
+
+bool LocalSource::stat(const std::string &path, LocalFile *file) {
+    struct stat st;
+    if(::stat(path.c_str(), &st) != 0)
+        return false;
+
+    file->path = path;
+    file->mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+    file->size = st.st_size;
+    return true;
+}
+
+// the .vcf files of dir, hidden files (i.e. vdirsyncer's temporary files) are skipped
+bool LocalSource::collect(const std::string &dir, int depth, std::vector<LocalFile> *files) const {
+    DIR* d = opendir(dir.c_str());
+    if(d == NULL) {
+        std::cerr << "Can't read directory '" << dir << "' of config section [" << section << "]: " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct dirent* entry;
+    while((entry = readdir(d)) != NULL) {
+        std::string name(entry->d_name);
+        if(name.size() == 0 || name[0] == '.')
+            continue;
+
+        std::string path = dir + "/" + name;
+        struct stat st;
+        if(::stat(path.c_str(), &st) != 0)
+            continue;
+
+        if(S_ISDIR(st.st_mode)) {
+            if(depth < MAX_VDIR_DEPTH)
+                collect(path, depth + 1, files);
+        } else if(isVcf(name)) {
+            LocalFile f;
+            f.path = path;
+            f.mtime = (long long)st.st_mtim.tv_sec * 1000000000LL + st.st_mtim.tv_nsec;
+            f.size = st.st_size;
+            files->push_back(f);
+        }
+    }
+
+    closedir(d);
+    return true;
+}
+
+// a directory is searched for .vcf files, anything else is read as a single file
+bool LocalSource::scan(std::vector<LocalFile> *files) const {
+    if(FileUtils::dirExists(root))
+        return collect(root, 0, files);
+
+    LocalFile f;
+    if(false == stat(root, &f)) {
+        std::cerr << "Can't find '" << root << "' of config section [" << section << "]" << std::endl;
+        return false;
+    }
+    files->push_back(f);
+    return true;
+}
+
+bool LocalSource::listFiles(std::vector<std::string> *paths) const {
+    std::vector<LocalFile> files;
+    if(false == scan(&files))
+        return false;
+
+    for(unsigned int i=0; i<files.size(); i++)
+        paths->push_back(files.at(i).path);
+    return true;
+}
+
+// maps the file and cuts it into cards, without reading it into a buffer
+// first. A full batch is written to the cache before the file is cut further
+bool LocalSource::readCards(const std::string &path, sqlite3_int64 fileId, CardBatch *batch) {
+    int fd = open(path.c_str(), O_RDONLY);
+    if(fd < 0) {
+        std::cerr << "Can't open '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    struct stat st;
+    if(fstat(fd, &st) != 0) {
+        close(fd);
+        return false;
+    }
+
+    // an empty file has no cards, and can't be mapped anyway
+    if(st.st_size == 0) {
+        close(fd);
+        return true;
+    }
+
+    void* data = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+    close(fd);
+    if(data == MAP_FAILED) {
+        std::cerr << "Can't map '" << path << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    madvise(data, st.st_size, MADV_SEQUENTIAL);
+
+    bool ok = true;
+    size_t offset = 0;
+    while(ok && offset < (size_t)st.st_size) {
+        size_t before = batch->chunks.size();
+        size_t room = batch->maxBytes > batch->bytes ? batch->maxBytes - batch->bytes : 0;
+        size_t split = ParallelParser::splitCards(static_cast<const char*>(data) + offset, st.st_size - offset, room, &batch->chunks);
+
+        for(size_t i=before; i<batch->chunks.size(); i++)
+            batch->bytes += batch->chunks.at(i).size();
+        batch->fileIds.insert(batch->fileIds.end(), batch->chunks.size() - before, fileId);
+        offset += split;
+
+        if(batch->bytes >= batch->maxBytes)
+            ok = flush(batch);
+    }
+    munmap(data, st.st_size);
+
+    Stats::count("bytes_read", st.st_size);
+    return ok;
+}
+
+// parses the cards of the batch on all cores and hands them to the importer
+bool LocalSource::flush(CardBatch *batch) {
+    if(batch->chunks.size() == 0)
+        return true;
+
+    std::vector<size_t> origins;
+    std::vector<Person> people = ParallelParser::parse(batch->chunks, NULL, &origins);
+    for(unsigned int i=0; i<people.size(); i++)
+        people[i].fileId = batch->fileIds.at(origins.at(i));
+
+    batch->chunks.clear();
+    batch->fileIds.clear();
+    batch->bytes = 0;
+    batch->imported += people.size();
+
+    Stats::count("sync_batches");
+    return batch->importer->addCards(people);
+}
+
+bool LocalSource::sync(Cache *cache, size_t maxBatchBytes, int *changedFiles, int *importedCards) {
+    StatsTimer timer("LocalSource::sync");
+
+    std::vector<LocalFile> files;
+    if(false == scan(&files))
+        return false;
+
+    std::map<std::string, CachedFile> known;
+    if(false == cache->getFiles(section, &known))
+        return false;
+
+    return update(cache, files, known, maxBatchBytes, changedFiles, importedCards);
+}
+
+bool LocalSource::contains(const std::string &path) const {
+    if(path == root)
+        return true;
+
+    // a hidden file is a temporary one of the sync tool, renamed once complete
+    size_t slash = path.rfind('/');
+    std::string name = slash == std::string::npos ? path : path.substr(slash + 1);
+    return FileUtils::dirExists(root) && path.compare(0, root.size() + 1, root + "/") == 0
+            && name.size() > 0 && name[0] != '.' && isVcf(name);
+}
+
+bool LocalSource::syncPaths(Cache *cache, const std::set<std::string> &paths, size_t maxBatchBytes, int *changedFiles, int *importedCards) {
+    StatsTimer timer("LocalSource::sync");
+
+    std::vector<LocalFile> files;
+    std::map<std::string, CachedFile> known;
+    for(std::set<std::string>::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+        if(false == contains(*it))
+            continue;
+
+        LocalFile f;
+        if(stat(*it, &f))
+            files.push_back(f);
+
+        CachedFile c;
+        if(cache->getFile(*it, &c))
+            known[*it] = c;
+    }
+
+    return update(cache, files, known, maxBatchBytes, changedFiles, importedCards);
+}
+
+std::vector<std::string> LocalSource::watchDirs() const {
+    std::vector<std::string> dirs;
+    if(false == FileUtils::dirExists(root)) {
+        size_t slash = root.rfind('/');
+        dirs.push_back(slash == std::string::npos ? "." : (slash == 0 ? "/" : root.substr(0, slash)));
+        return dirs;
+    }
+
+    dirs.push_back(root);
+    DIR* d = opendir(root.c_str());
+    if(d == NULL)
+        return dirs;
+
+    struct dirent* entry;
+    while((entry = readdir(d)) != NULL) {
+        std::string name(entry->d_name);
+        if(name.size() > 0 && name[0] != '.' && FileUtils::dirExists(root + "/" + name))
+            dirs.push_back(root + "/" + name);
+    }
+    closedir(d);
+    return dirs;
+}
+
+// files are the files found on disk, known the files the cache knows of
+// them. Whatever is in known but not in files is gone
+bool LocalSource::update(Cache *cache, const std::vector<LocalFile> &files, std::map<std::string, CachedFile> &known, size_t maxBatchBytes, int *changedFiles, int *importedCards) {
+    // only new and modified files are read, their cards replace the old ones batch by batch
+    CacheImporter importer(cache, CacheImporter::LocalFiles);
+    importer.setSection(section);
+
+    CardBatch batch;
+    batch.importer = &importer;
+    batch.maxBytes = maxBatchBytes;
+    batch.bytes = 0;
+    batch.imported = 0;
+
+    int changed = 0;
+    int removed = 0;
+    for(unsigned int i=0; i<files.size(); i++) {
+        const LocalFile& f = files.at(i);
+        std::map<std::string, CachedFile>::iterator it = known.find(f.path);
+        bool unchanged = it != known.end() && it->second.mtime == f.mtime && it->second.size == f.size;
+        if(it != known.end())
+            known.erase(it);
+
+        if(unchanged)
+            continue;
+
+        sqlite3_int64 id = cache->setFile(section, f.path, f.mtime, f.size);
+        if(id == 0 || false == cache->clearFile(id, false))
+            return false;
+
+        if(false == readCards(f.path, id, &batch)) {
+            // deleted between listing and reading it
+            if(FileUtils::fileExists(f.path) || importer.failed() || false == cache->clearFile(id, true))
+                return false;
+            removed++;
+            continue;
+        }
+        changed++;
+    }
+
+    if(false == flush(&batch))
+        return false;
+
+    // whatever is left in known was deleted since the last sync
+    for(std::map<std::string, CachedFile>::const_iterator it = known.begin(); it != known.end(); ++it) {
+        if(Option::isVerbose())
+            std::cout << "Removing cards of deleted file " << it->first << std::endl;
+        if(false == cache->clearFile(it->second.id, true))
+            return false;
+    }
+    removed += known.size();
+
+    std::cout << "Config section [" << section << "]: " << files.size() << " files, " << changed << " changed, "
+              << removed << " removed, " << batch.imported << " vcards imported" << std::endl;
+
+    if(changedFiles)
+        *changedFiles = changed + removed;
+    if(importedCards)
+        *importedCards = batch.imported;
+
+    return true;
+}
@@ -0,0 +1,71 @@
+#ifndef LOCALSOURCE_H
+#define LOCALSOURCE_H
+
+#include <string>
+#include <vector>
+#include <set>
+#include <map>
+#include "cache.h"
+#include "cacheimporter.h"
+
+// A config section with path= instead of a server: a vdir as written by
+// vdirsyncer, i.e. a directory of .vcf files (collections in direct
+// subdirectories included), or a single .vcf file holding any number of
+// cards. Files are read through mmap and parsed on all cores, in batches
+// of at most maxBatchBytes of cards. The cache remembers mtime and size of
+// every file, a sync only reads the files that changed and drops the cards
+// of files that are gone.
+class LocalSource
+{
+public:
+    LocalSource(const std::string& section, const std::string& path);
+
+    // brings the cards of the section in cache up to date, run it inside a
+    // transaction. changedFiles receives the number of files read or removed,
+    // importedCards the number of cards read from them
+    bool sync(Cache* cache, size_t maxBatchBytes, int* changedFiles = NULL, int* importedCards = NULL);
+
+    // the same for the given files only, as reported by a file system watch
+    bool syncPaths(Cache* cache, const std::set<std::string>& paths, size_t maxBatchBytes, int* changedFiles = NULL, int* importedCards = NULL);
+
+    // the files a sync would look at
+    bool listFiles(std::vector<std::string>* files) const;
+
+    // the directories to watch for changes and whether a path is one of our files
+    std::vector<std::string> watchDirs() const;
+    bool contains(const std::string& path) const;
+
+    const std::string& path() const;
+
+private:
+    struct LocalFile
+    {
+        std::string path;
+        long long mtime;
+        long long size;
+    };
+
+    // the cards read but not parsed yet, with the file id of each
+    struct CardBatch
+    {
+        CacheImporter* importer;
+        size_t maxBytes;
+        size_t bytes;
+        std::vector<std::string> chunks;
+        std::vector<sqlite3_int64> fileIds;
+        int imported;
+    };
+
+    std::string section;
+    std::string root;
+
+    bool scan(std::vector<LocalFile>* files) const;
+    bool update(Cache* cache, const std::vector<LocalFile>& files, std::map<std::string, CachedFile>& known, size_t maxBatchBytes, int* changedFiles, int* importedCards);
+    bool collect(const std::string& dir, int depth, std::vector<LocalFile>* files) const;
+    static bool stat(const std::string& path, LocalFile* file);
+    static bool readCards(const std::string& path, sqlite3_int64 fileId, CardBatch* batch);
+    static bool flush(CardBatch* batch);
+    static bool isVcf(const std::string& name);
+};
+
+#endif // LOCALSOURCE_H
@@ -21,6 +21,7 @@
 #include "vCard/vcard.h"
 #include "vCard/strutils.h"
 #include <vector>
+#include <algorithm>
 #include <sys/stat.h>
 #include "option.h"
 #include "cardcurler.h"
@@ -30,6 +31,15 @@
 #include "cache.h"
 #include "fileutils.h"
 #include "searchtemplates.h"
+#include "stats.h"
+#include "curlmetrics.h"
+#include "querylog.h"
+#include "resultwriter.h"
+#include "searchsession.h"
+#include "aliasexporter.h"
+#include "localsource.h"
+#include "vdirwatcher.h"
+#include "cacheimporter.h"
 
 void printError(const std::string &detail) {
     cout << detail << endl << endl;
@@ -56,20 +66,69 @@ void printError(const std::string &detail) {
     cout << "$ " << APPNAME << "  --name=GIVE-IT-A-NAME \\" << endl;
     cout << "                   --server=OWNCLOUD|SOGo-CARDDAV-URL|Davical|... \\" << endl;
     cout << "                   --username=USERNAME \\" << endl;
-    cout << "                   --password=PASSWORD \\" << endl << endl;
+    cout << "                   --password=PASSWORD \\" << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << "  --name=GIVE-IT-A-NAME --path=VDIR|FILE.vcf" << endl;
+    cout << endl;
+    cout << "reads the cards of this section from a local vdir, i.e. kept up to date by vdirsyncer," << endl;
+    cout << "or a single .vcf file instead of a server. Only --create-local-cache reads it." << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << " --watch [--section=NAME[,NAME]]" << endl;
+    cout << endl;
+    cout << "keeps running and applies every change to the files of these sections to the cache" << endl;
+    cout << "within a second, until interrupted." << endl << endl;
 
     cout << ":::: Cache ::::" << endl;
     cout << endl;
-    cout << "$ " << APPNAME << " --create-local-cache" << endl;
+    cout << "$ " << APPNAME << " --create-local-cache [--strip-binary] [--compress] [--max-memory=MB] [--resume]" << endl;
     cout << endl;
     cout << APPNAME << " will then create a local cache of all your vcards and will return data from" << endl;
-    cout << "the cache first. If no data was found '" << APPNAME << "' will then query the server." << endl << endl;
+    cout << "the cache first. If no data was found '" << APPNAME << "' will then query the server." << endl;
+    cout << "A new cache only downloads the cards changed on the server since the old one was built," << endl;
+    cout << "address books whose ctag did not change are not even listed." << endl;
+    cout << "--strip-binary drops photos, logos, sounds and keys from the stored vcards and" << endl;
+    cout << "--compress stores them deflated, which makes the cache a lot smaller." << endl;
+    cout << "Cards are written to the cache in batches while downloading, --max-memory=MB bounds the" << endl;
+    cout << "memory they take (default 64). Failed downloads are retried, if they keep failing the cards" << endl;
+    cout << "stored so far are kept and --resume continues from there." << endl;
+    cout << "Add --section=NAME[,NAME] to refresh only these config sections in the existing cache." << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << " --export-aliases[=FILE] [--export-flat[=FILE]]" << endl;
+    cout << endl;
+    cout << "writes the cache as a sorted mutt alias file (default ~/.config/" << APPNAME << "/aliases)" << endl;
+    cout << "and a tab separated 'email<TAB>name' file (default ~/.config/" << APPNAME << "/contacts.tsv)." << endl;
+    cout << "Both options work with --create-local-cache too, and existing files at the default places" << endl;
+    cout << "are refreshed after every cache update. Files are only rewritten if their content changed." << endl << endl;
 
     cout << ":::: Search ::::" << endl;
     cout << endl;
     cout << "$ " << APPNAME << " <query>" << endl;
     cout << endl;
-    cout << "where <query> is part of the fullname or email to search. Dont use wildcards, like *" << endl << endl;
+    cout << "where <query> is part of the fullname or email to search. Dont use wildcards, like *" << endl;
+    cout << "Add --section=NAME[,NAME] to search only these config sections, in the given order." << endl;
+    cout << "If nothing in the cache matches exactly, names and addresses within one or two typos are returned," << endl;
+    cout << "--no-fuzzy turns that off." << endl;
+    cout << "Online searches return at most 50 cards per server, change that with --limit=N (0 means no limit)." << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << " --complete <prefix>" << endl;
+    cout << endl;
+    cout << "returns the first 10 (or --limit=N) cached addresses starting with <prefix>, followed by the cards" << endl;
+    cout << "with a name or address part starting with it. Of several words only the last is a prefix." << endl;
+    cout << "Meant for as you type completion, never goes online." << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << " --batch < queries.txt" << endl;
+    cout << endl;
+    cout << "answers one query per line of stdin. Each answer starts with '# <query><TAB><results>'" << endl;
+    cout << "followed by the results and an empty line." << endl << endl;
+
+    cout << ":::: Statistics ::::" << endl;
+    cout << endl;
+    cout << "Add --stats or --stats=json to any command to print the time spent in each phase" << endl;
+    cout << "and a few counters to stderr." << endl;
+    cout << endl;
+    cout << "$ " << APPNAME << " --stats-report[=DAYS]" << endl;
+    cout << endl;
+    cout << "prints the latency percentiles and the cache hit rate of the searches of the last DAYS days (default 7)." << endl << endl;
 
     cout << ":::: Notes ::::" << endl;
     cout << endl;
@@ -87,21 +146,109 @@ void printError(const std::string &detail) {
     cout << endl;
 }
 
+// --export-aliases[=FILE] and --export-flat[=FILE] write the given files, after
+// a sync the files at the default places are refreshed as well if they exist
+static bool exportFiles(Option& opt, bool refreshExisting) {
+    std::string aliasFile = opt.getOption("--export-aliases");
+    if(aliasFile.size() == 0 && (opt.hasOption("--export-aliases") || (refreshExisting && FileUtils::fileExists(AliasExporter::defaultAliasFile()))))
+        aliasFile = AliasExporter::defaultAliasFile();
+
+    std::string flatFile = opt.getOption("--export-flat");
+    if(flatFile.size() == 0 && (opt.hasOption("--export-flat") || (refreshExisting && FileUtils::fileExists(AliasExporter::defaultFlatFile()))))
+        flatFile = AliasExporter::defaultFlatFile();
+
+    if(aliasFile.size() == 0 && flatFile.size() == 0)
+        return true;
+
+    if(false == FileUtils::fileExists(Settings::getCacheFile())) {
+        cerr << "There is no cache to export, run --create-local-cache first" << endl;
+        return false;
+    }
+
+    std::vector<Person> people;
+    Cache cache;
+    if(false == cache.allEntries(&people))
+        return false;
+
+    bool ok = true;
+    if(aliasFile.size() > 0)
+        ok = AliasExporter::exportAliases(people, aliasFile) && ok;
+    if(flatFile.size() > 0)
+        ok = AliasExporter::exportFlat(people, flatFile) && ok;
+
+    return ok;
+}
+
+// applies the changes of one burst to the cache in a single transaction
+static bool applyBurst(Option& opt, const WatchBurst& burst) {
+    double start = Stats::now();
+    Cache cache;
+    if(false == cache.beginTransaction())
+        return false;
+
+    // the same budget as for --create-local-cache
+    int maxMemory = DEFAULT_MAX_MEMORY_MB;
+    if(opt.getOption("--max-memory").size() > 0)
+        maxMemory = atoi(opt.getOption("--max-memory").c_str());
+
+    int changed = 0;
+    int imported = 0;
+    bool ok = true;
+    for(std::set<LocalSource*>::const_iterator it = burst.rescan.begin(); ok && it != burst.rescan.end(); ++it) {
+        int files = 0, cards = 0;
+        ok = (*it)->sync(&cache, CacheImporter::batchBytes(maxMemory), &files, &cards);
+        changed += files;
+        imported += cards;
+    }
+
+    for(std::map<LocalSource*, std::set<std::string> >::const_iterator it = burst.paths.begin(); ok && it != burst.paths.end(); ++it) {
+        if(burst.rescan.count(it->first) > 0)
+            continue;
+
+        int files = 0, cards = 0;
+        ok = it->first->syncPaths(&cache, it->second, CacheImporter::batchBytes(maxMemory), &files, &cards);
+        changed += files;
+        imported += cards;
+    }
+
+    if(false == ok || false == cache.commitTransaction()) {
+        cache.rollbackTransaction();
+        return false;
+    }
+
+    cout << "Applied " << changed << " changed files (" << imported << " vcards) in "
+         << (int)((Stats::now() - start) * 1000) << " ms" << endl;
+
+    if(changed > 0)
+        return exportFiles(opt, true);
+    return true;
+}
+
 int main(int argc, char *argv[])
 {
+    double startup = Stats::now();
     Settings cfg;
     Option opt(argc, argv, &cfg);
     std::string search = "";
 
+    // the report is printed to stderr on exit
+    if(opt.hasOption("--stats") || opt.getOption("--stats") == "json")
+        Stats::enable(opt.getOption("--stats") == "json");
+
     if(opt.doConfig()) {
         opt.configure();
         return 0;
+    } else if(opt.hasOption("--stats-report") || opt.getOption("--stats-report").size() > 0) {
+        int days = atoi(opt.getOption("--stats-report").c_str());
+        QueryLog log(Settings::getStatsFile());
+        return log.report(days > 0 ? days : 7) ? 0 : 1;
     } else if (argc < 2) {
         printError("invalid or missing arguments");
         return 1;
     } else {
-        // combine all the args in a space separated string.
+        // combine all the args in a space separated string, skipping our own --options
         for(int i=1; i<argc; i++) {
+            if(StringUtils::startsWith(argv[i], "--")) continue;
             if(search != "") search += " ";
             search += argv[i];
         }
@@ -113,145 +260,376 @@ int main(int argc, char *argv[])
         return 1;
     }
 
-    // contains default search template strings for searching and exporting vcards
-    SearchTemplates st;
+    Stats::addTiming("main.config", Stats::now() - startup);
+    double phase;
 
-    // preset search template
-    bool doCache = false;
-
-    std::string query = st.getDefaultSearchTemplate();
-    if(opt.hasOption("--create-local-cache")) {
-        query = st.getDefaultExportTemplate();
-
-        // overwrite the default export template with one the user provided
-        std::string templateFile = FileUtils::getHomeDir() + "/" + cfg.getConfigDir() + "/export.xml";
-        if(FileUtils::fileExists(templateFile)) {
-            if(false == FileUtils::getFileContent(templateFile, &query))
-                return 1;
-        }
+    // a search answered by the cache needs neither the templates nor libcurl,
+    // both are loaded only once we know we have to go online
+    bool doCache = opt.hasOption("--create-local-cache");
+    std::string query;
 
-        doCache = true;
+    // fetch the list of curlers (idea and partially code by Benjamin Frank <bfrank@net.t-labs.tu-berlin.de> on March 9, 2013)
+    std::vector<std::string> sections = cfg.getSections();
 
-    } else {
-        // overwrite the default search template with one the user provided
-        std::string templateFile = FileUtils::getHomeDir() + "/" + cfg.getConfigDir() + "/search.xml";
-        if(FileUtils::fileExists(templateFile)) {
-            if(false == FileUtils::getFileContent(templateFile, &query))
-                return 1;
+    // --section=a,b restricts the cache refresh or the search to these sections
+    std::vector<std::string> selectedSections = opt.getOptionList("--section");
+    for(unsigned int i=0; i<selectedSections.size(); i++) {
+        if(std::find(sections.begin(), sections.end(), selectedSections.at(i)) == sections.end()) {
+            cerr << "Unknown config section '" << selectedSections.at(i) << "'" << endl;
+            return 1;
         }
     }
 
-    // fetch the list of curlers (idea and partially code by Benjamin Frank <bfrank@net.t-labs.tu-berlin.de> on March 9, 2013)
-    std::vector<std::string> sections = cfg.getSections();
+    if(selectedSections.size() > 0)
+        sections = selectedSections;
+
+    // --limit=0 asks the server for all matches
+    int limit = DEFAULT_SEARCH_LIMIT;
+    if(opt.getOption("--limit").size() > 0)
+        limit = atoi(opt.getOption("--limit").c_str());
 
     // there is the cache ;)
-    std::string cachefile = cfg.getCacheFile();
-    std::vector<Person> people;
+    std::string cachefile = Settings::getCacheFile();
 
     if(true == doCache) {
-        if(FileUtils::fileExists(cachefile)) {
-            if(FileUtils::fileRemove(cachefile)) {
-                cout << "Old cache deleted" << endl;
-            } else {
-                cerr << "Failed to remove old cache database: " << cachefile << endl;
+        // the old cache stays in place and keeps answering searches until the new one is complete
+        Stats::setValue("path", "sync");
+        if(false == SearchTemplates::load(true, &query))
+            return 1;
+
+        // with --section only the partitions of these sections are replaced in the existing cache
+        bool refreshSections = selectedSections.size() > 0 && FileUtils::fileExists(cachefile);
+
+        // cards go into the cache batch by batch while the download goes on,
+        // the budget bounds how much of the address book is in memory at once
+        int maxMemory = DEFAULT_MAX_MEMORY_MB;
+        if(opt.getOption("--max-memory").size() > 0)
+            maxMemory = atoi(opt.getOption("--max-memory").c_str());
+
+        // --resume continues in the new cache an interrupted run left behind
+        bool resume = opt.hasOption("--resume");
+        if(resume && selectedSections.size() > 0) {
+            cerr << "--resume continues a full --create-local-cache, it can't be combined with --section" << endl;
+            return 1;
+        }
+
+        Cache cache;
+
+        if(resume) {
+            if(false == cache.resumeDatabase())
+                return 1;
+        } else if(false == refreshSections) {
+            if(false == cache.createDatabase())
+                return 1;
+
+            // optionally drop photos and friends and deflate the raw cards
+            if(false == cache.setStorageOptions(opt.hasOption("--compress"), opt.hasOption("--strip-binary")))
                 return 1;
-            }
         }
 
+        // the cards of the cache being replaced are only downloaded again if they changed,
+        // a refresh asks the same about the cards of the cache it updates
+        bool revalidate = false == refreshSections && cache.attachPrevious(cachefile);
+
+        // the whole import is a single transaction, a new cache commits after every batch
+        if(false == cache.beginTransaction())
+            return 1;
+
+        phase = Stats::now();
+        std::cout << "Importing vcards" << std::endl;
+
+        CacheImporter importer(&cache, refreshSections ? CacheImporter::ReplaceSections : (resume ? CacheImporter::ResumeCache : CacheImporter::NewCache));
+        std::vector<std::string> localSections;
+        int resumedCards = 0;
+
+        // a section without cards on the server is synced too, a refresh empties it
+        int syncedSections = 0;
         for(std::vector<std::string>::iterator it = sections.begin(); it != sections.end(); ++it) {
             std::string section(*it);
 
-            std::string server(cfg.getProperty(section, "server"));
+            // local sections are read straight into the cache further down
+            if(cfg.isLocal(section)) {
+                localSections.push_back(section);
+                continue;
+            }
+
+            // the cards an interrupted run stored already
+            std::set<std::string> done;
+            if(resume) {
+                bool complete = false;
+                if(false == cache.getSyncProgress(section, &complete, &done)) {
+                    cache.rollbackTransaction();
+                    return 1;
+                }
+
+                if(complete) {
+                    std::cout << "Config section [" << section << "] was synced before the interruption" << std::endl;
+                    syncedSections++;
+                    continue;
+                }
+                resumedCards += done.size();
+            }
+
+            const std::string& server = cfg.getProperty(section, "server");
             std::string url(Url::removePath(server));
             std::cout << "Creating cache entries for config section [" << section << "], URL: [" << server << "]" << std::endl;
 
+            std::map<std::string, CardValidators> known;
+            if((revalidate || refreshSections) && false == cache.getValidators(section, revalidate, &known)) {
+                cache.rollbackTransaction();
+                return 1;
+            }
+
+            std::string ctag;
             if(url.size() > 0) {
-                CardCurler cc(cfg.getProperty(section, "username"), cfg.getProperty(section, "password"), server, argv[1]);
-                std::vector<Person> tmp_people = cc.getAllCards(url, query);
-                people.insert(people.end(), tmp_people.begin(), tmp_people.end());
+                CardCurler cc(cfg.getProperty(section, "username"), cfg.getProperty(section, "password"), server, search);
+                cc.setSection(section);
+                importer.setSection(section);
+
+                // an unchanged collection costs a single small PROPFIND, no listing and no downloads
+                if(false == cc.getCTag(query, &ctag)) {
+                    cache.rollbackTransaction();
+                    cout << "Import of config section [" << section << "] failed. The old cache was kept" << endl;
+                    CurlMetrics::report();
+                    return 1;
+                }
+
+                std::string lastUrl, lastTag;
+                if(ctag.size() > 0 && (refreshSections || revalidate)
+                        && false == cache.getCollectionTag(section, revalidate, &lastUrl, &lastTag)) {
+                    cache.rollbackTransaction();
+                    return 1;
+                }
+
+                if(ctag.size() > 0 && lastUrl == server && lastTag == ctag) {
+                    Stats::count("sync_ctag_unchanged");
+                    syncedSections++;
+
+                    // a refresh leaves the section as it is, a new cache takes its cards over from the old one
+                    if(refreshSections) {
+                        std::cout << "Config section [" << section << "] is unchanged on the server" << std::endl;
+                        continue;
+                    }
+
+                    std::vector<std::string> hrefs;
+                    for(std::map<std::string, CardValidators>::const_iterator k = known.begin(); k != known.end(); ++k) {
+                        if(done.count(k->first) == 0)
+                            hrefs.push_back(k->first);
+                    }
+
+                    if(importer.keepCards(hrefs) < 0) {
+                        cache.rollbackTransaction();
+                        cout << "Import of config section [" << section << "] failed. The old cache was kept" << endl;
+                        return 1;
+                    }
+                    std::cout << "Config section [" << section << "] is unchanged on the server, " << hrefs.size() << " cards kept" << std::endl;
+                } else if(false == cc.getAllCards(url, query, &importer, CacheImporter::batchBytes(maxMemory), &done, &known)) {
+                    // a refresh is all or nothing, a new cache keeps what made it in for --resume
+                    if(refreshSections || importer.failed()) {
+                        cache.rollbackTransaction();
+                        cout << "Import of config section [" << section << "] failed. The old cache was kept" << endl;
+                    } else {
+                        cache.commitTransaction();
+                        cache.keepPartialDatabase();
+                        cout << "Sync of config section [" << section << "] was interrupted. The old cache was kept, run" << endl;
+                        cout << APPNAME << " --create-local-cache --resume to continue where it stopped" << endl;
+                    }
+                    CurlMetrics::report();
+                    return 1;
+                }
             }
-        }
 
-        if(people.size() > 0 ) {
-            Cache cache;
-            if(false == cache.createDatabase())
+            // a refreshed section drops the cards that changed or are gone from the server
+            if(false == importer.finishSection()) {
+                cache.rollbackTransaction();
                 return 1;
-
-            int numRecords = 0;
-            std::cout << "Importing vcards" << std::endl;
-
-            for(unsigned int i=0; i<people.size(); i++) {
-                Person p = people.at(i);
-                cache.addVCard(
-                            p.FirstName,
-                            p.LastName,
-                            p.Emails,
-                            p.rawCardData,
-                            p.lastUpdatedAt
-                );
-                numRecords++;
             }
 
-            chmod(cachefile.c_str(), S_IRUSR | S_IWUSR);
-            cout << "Cache created (" << numRecords << " records)" << endl;
-        } else {
-            cout << "Export failed, nothing found" << endl;
-        }
-    } else {
-        // 1. look into the cache
-        bool cacheMiss = false;
-        if(FileUtils::fileExists(cachefile)) {
-            if(Option::isVerbose()) {
-                std::cout << "Cache lookup in file " << cachefile;
+            // the ctag is taken before the listing, a change during the sync shows on the next one
+            if(false == cache.setCollectionTag(section, server, ctag)) {
+                cache.rollbackTransaction();
+                return 1;
             }
-            
-            people = CardCurler::curlCache(search);
 
-            if(Option::isVerbose()) {
-                std::cout << "Cache lookup returned " << people.size() << " records";
+            if(false == refreshSections && false == cache.setSectionSynced(section)) {
+                cache.rollbackTransaction();
+                return 1;
             }
+            syncedSections++;
         }
 
-        // nothing found in cache? => search online
-        if(people.size() == 0) {
-           cacheMiss = true;
-           StringUtils::replace(&query, "%s", search);
-
-           // isn't it a nice duplication? - so get rid of it, stupid!
-           for(std::vector<std::string>::const_iterator it = sections.begin(); it != sections.end(); ++it) {
-                std::string section(*it);
-                std::string server(cfg.getProperty(section, "server"));
-
-              if(server.size() > 0) {
-                   CardCurler cc(cfg.getProperty(section, "username"), cfg.getProperty(section, "password"), server, argv[1]);
-                   std::vector<Person> tmp_people = cc.curlCard(query);
-                   people.insert(people.end(), tmp_people.begin(), tmp_people.end());
-              }
-           }
-        }
+        Stats::addTiming("main.sync", Stats::now() - phase);
 
-        if(people.size() > 0) {
-            std::cout << std::endl; // needed by mutt to skip below the top line
-            for(unsigned int i=0; i<people.size(); i++) {
-                Person p = people.at(i);
-                for(unsigned int j=0; j < p.Emails.size(); j++) {
-                    std::cout << p.Emails.at(j) << '\t' << p.FirstName << ' ' << p.LastName << std::endl;
-                }
+        // a sync is run by hand, the transfer summary is always worth a look
+        CurlMetrics::report();
+        phase = Stats::now();
+
+        // a failed section returned above, here every section was synced
+        if(syncedSections > 0 || localSections.size() > 0) {
+            if(false == importer.finishTraining()) {
+                cache.rollbackTransaction();
+                return 1;
             }
 
-            // now update the cache
-            if(cacheMiss && FileUtils::fileExists(cachefile)) {
-                Cache cache;
-                cache.openDatabase();
-                for(unsigned int i=0; i<people.size(); i++) {
-                    Person p = people.at(i);
-                    cache.addVCard(p.FirstName, p.LastName, p.Emails, p.rawCardData, p.lastUpdatedAt);
+            int numRecords = importer.count() + resumedCards;
+
+            // a refresh only reads the files changed since the last import, a new cache
+            // starts without any and reads them all
+            for(unsigned int i=0; i<localSections.size(); i++) {
+                const std::string& section = localSections.at(i);
+                LocalSource source(section, cfg.getProperty(section, "path"));
+                std::cout << "Reading config section [" << section << "], path: [" << source.path() << "]" << std::endl;
+
+                int imported = 0;
+                if(false == source.sync(&cache, CacheImporter::batchBytes(maxMemory), NULL, &imported)) {
+                    cache.rollbackTransaction();
+                    cout << "Import of config section [" << section << "] failed. The old cache was kept" << endl;
+                    return 1;
                 }
+                numRecords += imported;
+            }
+
+            if(false == cache.commitTransaction())
+                return 1;
+
+            if(refreshSections) {
+                cout << "Cache sections refreshed (" << numRecords << " records)" << endl;
+            } else {
+                if(false == cache.commitDatabase())
+                    return 1;
+
+                cout << "Cache created (" << numRecords << " records)" << endl;
             }
 
+            Stats::addTiming("main.import", Stats::now() - phase);
+
+            phase = Stats::now();
+            if(false == exportFiles(opt, true))
+                return 1;
+            Stats::addTiming("main.export", Stats::now() - phase);
+        } else {
+            // the new cache file is dropped with cache
+            cache.rollbackTransaction();
+            cout << "Export failed, no config section to sync. The old cache was kept" << endl;
+        }
+    } else if(opt.hasOption("--export-aliases") || opt.hasOption("--export-flat")
+              || opt.getOption("--export-aliases").size() > 0 || opt.getOption("--export-flat").size() > 0) {
+        Stats::setValue("path", "export");
+        if(false == exportFiles(opt, false))
+            return 1;
+    } else if(opt.hasOption("--watch")) {
+        // keeps the cache in step with the local sections until interrupted
+        Stats::setValue("path", "watch");
+        if(false == FileUtils::fileExists(cachefile)) {
+            cerr << "There is no cache to update, run --create-local-cache first" << endl;
+            return 1;
+        }
+
+        std::vector<LocalSource*> sources;
+        for(unsigned int i=0; i<sections.size(); i++) {
+            if(cfg.isLocal(sections.at(i)))
+                sources.push_back(new LocalSource(sections.at(i), cfg.getProperty(sections.at(i), "path")));
+        }
+
+        if(sources.size() == 0) {
+            cerr << "There are no config sections with a path to watch" << endl;
+            return 1;
+        }
+
+        VdirWatcher watcher;
+        WatchBurst burst;
+        bool ok = true;
+        for(unsigned int i=0; ok && i<sources.size(); i++) {
+            ok = watcher.add(sources.at(i));
+            burst.rescan.insert(sources.at(i));
+        }
+
+        // catch up with whatever changed while nobody was watching
+        if(ok && false == applyBurst(opt, burst))
+            cerr << "Updating the cache failed" << endl;
+
+        while(ok && watcher.wait(&burst)) {
+            if(false == applyBurst(opt, burst))
+                cerr << "Updating the cache failed, trying again with the next change" << endl;
+        }
+
+        for(unsigned int i=0; i<sources.size(); i++)
+            delete sources.at(i);
+
+        if(false == ok)
+            return 1;
+    } else if(opt.hasOption("--complete")) {
+        // as you type completion straight from the prefix indexes of the
+        // cache, never online
+        Stats::setValue("path", "complete");
+        ResultWriter writer;
+        int completeLimit = DEFAULT_COMPLETE_LIMIT;
+        if(opt.getOption("--limit").size() > 0)
+            completeLimit = limit;
+
+        if(FileUtils::fileExists(cachefile)) {
+            Cache cache;
+            phase = Stats::now();
+            cache.writeCompletions(search, selectedSections, completeLimit, &writer);
+            Stats::addTiming("main.cache_lookup", Stats::now() - phase);
+        }
+
+        // not logged: a keystroke is not a search, and writing the log would cost more than the lookup
+        writer.flush();
+    } else if(opt.hasOption("--batch")) {
+        // one query per line on stdin, all answered by the same session.
+        // Each answer is a line '# <query><TAB><number of results>', the
+        // results and an empty line
+        SearchSession session(&cfg, sections, selectedSections, limit);
+        session.setFuzzy(false == opt.hasOption("--no-fuzzy"));
+        // the searches are logged together once stdin is done
+        QueryLog log(Settings::getStatsFile());
+        Stats::setValue("path", "batch");
+
+        std::string line;
+        while(std::getline(std::cin, line)) {
+            std::string q = StrUtils::trim(line);
+            if(q.size() == 0)
+                continue;
+
+            double begin = Stats::now();
+            std::stringstream block;
+            ResultWriter writer(block, false);
+            std::string path = session.search(q, &writer);
+            writer.flush();
+
+            std::cout << "# " << q << '\t' << writer.count() << '\n' << block.str() << '\n';
+            std::cout.flush();
+
+            log.append(path, writer.count(), (long)((Stats::now() - begin) * 1000000));
+        }
+
+        if(Stats::isEnabled() && CurlMetrics::hasData())
+            CurlMetrics::report();
+    } else {
+        // every line goes through the writer, which drops duplicate addresses
+        ResultWriter writer;
+        SearchSession session(&cfg, sections, selectedSections, limit);
+        session.setFuzzy(false == opt.hasOption("--no-fuzzy"));
+
+        // cache_hit, fuzzy_hit, online or negative, i.e. nothing found anywhere
+        std::string path = session.search(search, &writer);
+        Stats::setValue("path", path);
+
+        if(writer.count() > 0) {
+            phase = Stats::now();
+            writer.flush();
+            Stats::addTiming("main.output", Stats::now() - phase);
         } else {
             cout << "Search returned no results" << endl;
         }
+
+        if(Stats::isEnabled() && CurlMetrics::hasData())
+            CurlMetrics::report();
+
+        // the history behind --stats-report
+        QueryLog log(Settings::getStatsFile());
+        log.append(path, writer.count(), (long)((Stats::now() - startup) * 1000000));
     }
 
     return 0;
@@ -19,12 +19,13 @@
  ***************************************************************************/
 
 #include "option.h"
+#include "stringutils.h"
 
 Option::Option(int argc, char **argv, Settings *cfg)
 {
     _argc = argc;
     _argv = argv;
-    _cfg = *cfg;
+    _cfg = cfg;
 }
 
 bool Option::isVerbose() {
@@ -49,9 +50,9 @@ std::string Option::getOption(const std::string &option) {
     for(int i=1; i<_argc; i++) {
         std::string argument(_argv[i]);
 
-        int position = argument.find('=');
+        size_t position = argument.find('=');
         std::string left = argument.substr(0, position);
-        std::string right = argument.substr(position + 1);
+        std::string right = position == std::string::npos ? "" : argument.substr(position + 1);
 
         // sanitize me!
         if(left == option) return right;
@@ -60,10 +61,29 @@ std::string Option::getOption(const std::string &option) {
     return "";
 }
 
+// comma separated values, i.e. --section=work,private
+std::vector<std::string> Option::getOptionList(const std::string &option) {
+    std::vector<std::string> result;
+    std::string value = this->getOption(option);
+    if(value.length() == 0)
+        return result;
+
+    std::vector<std::string> tokens = StringUtils::split(value, ",");
+    for(unsigned int i=0; i<tokens.size(); i++) {
+        if(tokens.at(i).length() > 0)
+            result.push_back(tokens.at(i));
+    }
+
+    return result;
+}
+
 bool Option::doConfig() {
     std::string tmp = this->getOption("--name");
     if(tmp.length() == 0) return false;
 
+    // a local section only needs its path
+    if(this->getOption("--path").length() > 0) return true;
+
     tmp = this->getOption("--server");
     if(tmp.length() == 0) return false;
 
@@ -77,22 +97,26 @@ bool Option::doConfig() {
 }
 
 void Option::configure() {
-    // for the name option set the section!
+    // the name option names the section, the rest are its properties
     std::string section = this->getOption("--name");
-    _cfg.setSection(section);
-
-    // for the rest call setProperty
-    std::string tmp = this->getOption("--server");
-    _cfg.setProperty(section, "server", tmp);
+    std::map<std::string, std::string> properties;
+
+    std::string tmp = this->getOption("--path");
+    if(tmp.length() > 0) {
+        properties["path"] = tmp;
+    } else {
+        properties["server"] = this->getOption("--server");
+        properties["username"] = this->getOption("--username");
+        properties["password"] = this->getOption("--password");
+    }
 
-    tmp = this->getOption("--username");
-    _cfg.setProperty(section, "username", tmp);
+    _cfg->setSection(section, properties);
 
-    tmp = this->getOption("--password");
-    _cfg.setProperty(section, "password", tmp);
+    // write it now, so the chmod below applies to the new file
+    _cfg->save();
 
     // chmod go-a to the config file, ignore the results
-    chmod(_cfg.getConfigDir().c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
-    chmod(_cfg.getConfigFile().c_str(), S_IRUSR | S_IWUSR);
+    chmod((FileUtils::getHomeDir() + "/" + _cfg->getConfigDir()).c_str(), S_IRUSR | S_IWUSR | S_IXUSR);
+    chmod(_cfg->getConfigFile().c_str(), S_IRUSR | S_IWUSR);
 }
 
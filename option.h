@@ -24,6 +24,7 @@
 #include <string>
 #include <cstring>
 #include <stdlib.h>
+#include <vector>
 #include "settings.h"
 
 class Option
@@ -32,6 +33,7 @@ public:
     Option(int argc, char **argv, Settings* cfg);
     std::string getOption(const std::string &option);
     bool hasOption(const std::string &option);
+    std::vector<std::string> getOptionList(const std::string &option);
     void configure();
     bool doConfig();
     static bool isVerbose();
@@ -39,7 +41,7 @@ public:
 private:
     int _argc;
     char **_argv;
-    Settings _cfg;
+    Settings* _cfg;
 };
 
 #endif // OPTION_H
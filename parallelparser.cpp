@@ -0,0 +1,125 @@
+#include "parallelparser.h"
+#include "cardcurler.h"
+#include "stats.h"
+#include "vCard/vcard.h"
+#include "vCard/vcard_globals.h"
+#include <thread>
+#include <atomic>
+#include <algorithm>
+#include <iterator>
+#include <string.h>
+
+// chunks a worker takes at once, small enough to even out cards with and without photos
+#define PARSE_BATCH_SIZE 16
+
+// below this many chunks per thread starting the thread costs more than it saves
+#define MIN_CHUNKS_PER_WORKER 64
+
+std::vector<std::string> ParallelParser::splitCards(const std::string &text) {
+    std::vector<std::string> result;
+    splitCards(text.data(), text.size(), &result);
+    return result;
+}
+
+// works on memory that is no std::string, i.e. a mapped file
+void ParallelParser::splitCards(const char *data, size_t size, std::vector<std::string> *cards) {
+    splitCards(data, size, size, cards);
+}
+
+size_t ParallelParser::splitCards(const char *data, size_t size, size_t maxBytes, std::vector<std::string> *cards) {
+    static const size_t tokenSize = sizeof(VC_BEGIN_TOKEN) - 1;
+    const char* end = data + size;
+
+    size_t taken = 0;
+    const char* pos = static_cast<const char*>(memmem(data, size, VC_BEGIN_TOKEN, tokenSize));
+    while(pos != NULL) {
+        const char* next = static_cast<const char*>(memmem(pos + tokenSize, end - pos - tokenSize, VC_BEGIN_TOKEN, tokenSize));
+        size_t length = (next ? next : end) - pos;
+        if(taken > 0 && taken + length > maxBytes)
+            return pos - data;
+
+        cards->push_back(std::string(pos, length));
+        taken += length;
+        pos = next;
+    }
+    return size;
+}
+
+unsigned int ParallelParser::cores() {
+    unsigned int cores = std::thread::hardware_concurrency();
+    return cores > 0 ? cores : 1;
+}
+
+unsigned int ParallelParser::workers(size_t count) {
+    unsigned int cores = ParallelParser::cores();
+
+    size_t useful = count / MIN_CHUNKS_PER_WORKER;
+    if(useful < 1)
+        useful = 1;
+
+    return useful < cores ? useful : cores;
+}
+
+void ParallelParser::parseChunk(const std::string &raw, void (*prepare)(std::string*), std::vector<Person> *people) {
+    std::string prepared;
+    if(prepare) {
+        prepared = raw;
+        prepare(&prepared);
+    }
+
+    const std::string& chunk = prepare ? prepared : raw;
+    std::vector<vCard> cards = vCard::fromString(chunk);
+    for(unsigned int i=0; i<cards.size(); i++) {
+        Person p;
+        CardCurler::createPerson(&cards[i], &p);
+        if(p.isValid()) {
+            p.rawCardData = chunk;
+            people->push_back(p);
+        }
+    }
+}
+
+// timed per call rather than per card, a shared timer would serialize the workers
+std::vector<Person> ParallelParser::parse(const std::vector<std::string> &chunks, void (*prepare)(std::string*), std::vector<size_t> *origins) {
+    StatsTimer timer("ParallelParser::parse");
+
+    // every chunk has its own slot, so the workers never share a vector
+    std::vector< std::vector<Person> > parsed(chunks.size());
+    unsigned int threads = workers(chunks.size());
+
+    if(threads <= 1) {
+        for(size_t i=0; i<chunks.size(); i++)
+            parseChunk(chunks.at(i), prepare, &parsed[i]);
+    } else {
+        std::atomic<size_t> next(0);
+        std::vector<std::thread> pool;
+        for(unsigned int t=0; t<threads; t++) {
+            pool.push_back(std::thread([&]() {
+                size_t first;
+                while((first = next.fetch_add(PARSE_BATCH_SIZE)) < chunks.size()) {
+                    size_t last = std::min(first + PARSE_BATCH_SIZE, chunks.size());
+                    for(size_t i=first; i<last; i++)
+                        parseChunk(chunks.at(i), prepare, &parsed[i]);
+                }
+            }));
+        }
+
+        for(unsigned int t=0; t<pool.size(); t++)
+            pool[t].join();
+    }
+
+    size_t total = 0;
+    for(size_t i=0; i<parsed.size(); i++)
+        total += parsed[i].size();
+
+    Stats::count("cards_parsed", total);
+
+    std::vector<Person> people;
+    people.reserve(total);
+    for(size_t i=0; i<parsed.size(); i++) {
+        people.insert(people.end(), std::make_move_iterator(parsed[i].begin()), std::make_move_iterator(parsed[i].end()));
+        if(origins)
+            origins->insert(origins->end(), parsed[i].size(), i);
+    }
+    return people;
+}
@@ -0,0 +1,36 @@
+#ifndef PARALLELPARSER_H
+#define PARALLELPARSER_H
+
+#include <string>
+#include <vector>
+#include "person.h"
+
+// Turns raw vcard text into Persons on all cores. The input is a list
+// of chunks, each usually a single vcard, which are handed out to a pool
+// of worker threads in small batches. The Persons come back in the order
+// of the chunks, just as a single threaded loop would return them.
+class ParallelParser
+{
+public:
+    // splits text holding any number of vcards at each BEGIN:VCARD
+    static std::vector<std::string> splitCards(const std::string& text);
+    static void splitCards(const char* data, size_t size, std::vector<std::string>* cards);
+
+    // the same for the cards in the first maxBytes of data, at least one. Returns
+    // the bytes split off, size once there are no cards left
+    static size_t splitCards(const char* data, size_t size, size_t maxBytes, std::vector<std::string>* cards);
+
+    // the valid Persons of all chunks, each with its chunk as raw card data.
+    // prepare, if given, is run on each chunk by the worker before parsing.
+    // origins, if given, receives the index of the chunk of each Person
+    static std::vector<Person> parse(const std::vector<std::string>& chunks, void (*prepare)(std::string*) = NULL, std::vector<size_t>* origins = NULL);
+
+    // threads used for count chunks, at most one per core
+    static unsigned int workers(size_t count);
+    static unsigned int cores();
+
+    // the valid Persons of a single chunk, parsed by the calling thread
+    static void parseChunk(const std::string& raw, void (*prepare)(std::string*), std::vector<Person>* people);
+};
+
+#endif // PARALLELPARSER_H
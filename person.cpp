@@ -21,6 +21,7 @@
 #include "person.h"
 
 Person::Person()
+    : fileId(0)
 {
 }
 
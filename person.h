@@ -24,6 +24,13 @@
 #include <string>
 #include <vector>
 
+// what a server said about a card, to ask it later whether the card changed
+struct CardValidators
+{
+    std::string etag;
+    std::string lastModified;
+};
+
 class Person
 {
 public:
@@ -33,6 +40,10 @@ public:
     std::string lastUpdatedAt;
     std::vector< std::string > Emails;
     std::string rawCardData;
+    std::string section; // the config section the card was found in
+    std::string href;    // where a synced card came from on the server
+    long long fileId;    // the local file a card was read from, 0 for synced cards
+    CardValidators validators;
 
     bool isValid();
 };
@@ -0,0 +1,177 @@
+#include "querylog.h"
+#include "sqlitetimeout.h"
+#include <iostream>
+#include <iomanip>
+#include <algorithm>
+#include <map>
+#include <sstream>
+#include <vector>
+#include <time.h>
+#include <sys/stat.h>
+
+QueryLog::QueryLog(const std::string &logFile)
+{
+    db = NULL;
+    log_file = logFile;
+}
+
+QueryLog::~QueryLog()
+{
+    flush();
+    if(db)
+        sqlite3_close(db);
+}
+
+bool QueryLog::openDatabase() {
+    if(db) return true;
+
+    int retVal = sqlite3_open_v2(log_file.c_str(), &db, SQLITE_OPEN_READWRITE | SQLITE_OPEN_CREATE, NULL);
+    if(SQLITE_OK != retVal) {
+        std::cerr << "Can't open/create query log in " << log_file << ": " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_close(db);
+        db = NULL;
+        return false;
+    }
+
+    chmod(log_file.c_str(), S_IRUSR | S_IWUSR);
+    sqlite3_busy_timeout(db, SQLITE_BUSY_TIMEOUT_MS);
+
+    // losing the last record on a crash is fine, waiting for fsync on every search is not
+    if(false == exec("PRAGMA synchronous = OFF", "Can't configure query log"))
+        return false;
+
+    int version = 0;
+    sqlite3_stmt* stmt = NULL;
+    if(SQLITE_OK == sqlite3_prepare_v2(db, "PRAGMA user_version", -1, &stmt, NULL) && sqlite3_step(stmt) == SQLITE_ROW)
+        version = sqlite3_column_int(stmt, 0);
+    sqlite3_finalize(stmt);
+
+    if(version == QUERYLOG_SCHEMA_VERSION)
+        return true;
+
+    // Slot is Seq modulo the capacity, so a new row replaces the oldest one.
+    // seq_idx turns the MAX(Seq) of every append into a single index lookup.
+    // A log written before the index existed keeps its rows
+    std::stringstream schema;
+    schema << "CREATE TABLE IF NOT EXISTS queries (Slot INTEGER PRIMARY KEY, Seq INTEGER, At INTEGER, Path STRING, Results INTEGER, Micros INTEGER);"
+           << "CREATE INDEX IF NOT EXISTS at_idx ON queries (At);"
+           << "CREATE INDEX IF NOT EXISTS seq_idx ON queries (Seq);"
+           << "PRAGMA user_version = " << QUERYLOG_SCHEMA_VERSION << ";";
+
+    return exec(schema.str().c_str(), "Can't create query log table");
+}
+
+bool QueryLog::exec(const char *sql, const std::string &errMsg) {
+    char* error = NULL;
+    if(SQLITE_OK != sqlite3_exec(db, sql, NULL, NULL, &error)) {
+        std::cerr << errMsg << ": " << (error ? error : "") << std::endl;
+        sqlite3_free(error);
+        return false;
+    }
+
+    return true;
+}
+
+void QueryLog::append(const std::string &path, int results, long micros) {
+    Entry e;
+    e.path = path;
+    e.results = results;
+    e.micros = micros;
+    e.at = time(NULL);
+    pending.push_back(e);
+}
+
+bool QueryLog::flush() {
+    if(pending.size() == 0)
+        return true;
+
+    std::vector<Entry> entries;
+    entries.swap(pending);
+    if(false == openDatabase() || false == exec("BEGIN TRANSACTION", "Can't write query log"))
+        return false;
+
+    sqlite3_stmt* stmt = NULL;
+    const char* sql =
+            "INSERT OR REPLACE INTO queries (Slot, Seq, At, Path, Results, Micros)"
+            " SELECT (s + 1) % ?, s + 1, ?, ?, ?, ? FROM (SELECT COALESCE(MAX(Seq), 0) AS s FROM queries)";
+
+    if(SQLITE_OK != sqlite3_prepare_v2(db, sql, -1, &stmt, NULL)) {
+        std::cerr << "Can't prepare query log insert: " << sqlite3_errmsg(db) << std::endl;
+        exec("ROLLBACK TRANSACTION", "Can't roll back query log");
+        return false;
+    }
+
+    bool b = true;
+    for(unsigned int i=0; b && i<entries.size(); i++) {
+        const Entry& e = entries.at(i);
+        sqlite3_bind_int(stmt, 1, QUERYLOG_CAPACITY);
+        sqlite3_bind_int64(stmt, 2, (sqlite3_int64)e.at);
+        sqlite3_bind_text(stmt, 3, e.path.c_str(), -1, SQLITE_TRANSIENT);
+        sqlite3_bind_int(stmt, 4, e.results);
+        sqlite3_bind_int64(stmt, 5, e.micros);
+
+        b = sqlite3_step(stmt) == SQLITE_DONE;
+        if(false == b)
+            std::cerr << "Can't append to query log: " << sqlite3_errmsg(db) << std::endl;
+        sqlite3_reset(stmt);
+    }
+
+    sqlite3_finalize(stmt);
+    if(false == b) {
+        exec("ROLLBACK TRANSACTION", "Can't roll back query log");
+        return false;
+    }
+
+    return exec("COMMIT TRANSACTION", "Can't write query log");
+}
+
+static double percentile(const std::vector<long>& sorted, double p) {
+    if(sorted.size() == 0)
+        return 0;
+
+    return sorted.at((size_t)(p * (sorted.size() - 1) + 0.5));
+}
+
+bool QueryLog::report(int days) {
+    if(false == openDatabase())
+        return false;
+
+    sqlite3_stmt* stmt = NULL;
+    if(SQLITE_OK != sqlite3_prepare_v2(db, "SELECT Path, Micros FROM queries WHERE At >= ? ORDER BY Path, Micros", -1, &stmt, NULL)) {
+        std::cerr << "Can't read query log: " << sqlite3_errmsg(db) << std::endl;
+        return false;
+    }
+
+    sqlite3_bind_int64(stmt, 1, (sqlite3_int64)time(NULL) - (sqlite3_int64)days * 86400);
+
+    // the rows come sorted by path and latency already
+    std::map<std::string, std::vector<long> > paths;
+    long total = 0;
+    while(sqlite3_step(stmt) == SQLITE_ROW) {
+        const unsigned char* path = sqlite3_column_text(stmt, 0);
+        paths[path ? reinterpret_cast<const char*>(path) : ""].push_back((long)sqlite3_column_int64(stmt, 1));
+        total++;
+    }
+    sqlite3_finalize(stmt);
+
+    std::cout << "Query latency over the last " << days << " day(s), " << total << " queries" << std::endl;
+    if(total == 0)
+        return true;
+
+    std::cout << std::endl << std::left << std::setw(12) << "path" << std::right << std::setw(10) << "queries"
+              << std::setw(12) << "p50 ms" << std::setw(12) << "p90 ms" << std::setw(12) << "p99 ms" << std::endl;
+    std::cout << std::fixed << std::setprecision(2);
+
+    for(std::map<std::string, std::vector<long> >::const_iterator it = paths.begin(); it != paths.end(); ++it) {
+        const std::vector<long>& micros = it->second;
+        std::cout << std::left << std::setw(12) << it->first << std::right << std::setw(10) << micros.size()
+                  << std::setw(12) << percentile(micros, 0.50) / 1000
+                  << std::setw(12) << percentile(micros, 0.90) / 1000
+                  << std::setw(12) << percentile(micros, 0.99) / 1000 << std::endl;
+    }
+
+    // typos answered by the fuzzy search never reached a server either
+    size_t hits = paths["cache_hit"].size() + paths["fuzzy_hit"].size();
+    std::cout << std::endl << "Cache hit rate: " << std::setprecision(1) << hits * 100.0 / total << "%" << std::endl;
+    return true;
+}
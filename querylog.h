@@ -0,0 +1,48 @@
+#ifndef QUERYLOG_H
+#define QUERYLOG_H
+
+#include <string>
+#include <vector>
+#include <time.h>
+#include <sqlite3.h>
+
+// the log keeps this many queries, older ones are overwritten
+#define QUERYLOG_CAPACITY 10000
+
+// bump this whenever the table layout changes
+#define QUERYLOG_SCHEMA_VERSION 1
+
+// Remembers how long each search took and which path it went, cache hit,
+// online after a cache miss or negative (found nowhere), in a ring buffer
+// table of a small side database. --stats-report prints the latency
+// percentiles per path and the cache hit rate from it. Searches are kept
+// in memory and written in one transaction when the log is flushed or
+// destroyed, the database is only opened then.
+class QueryLog
+{
+public:
+    explicit QueryLog(const std::string& logFile);
+    ~QueryLog();
+
+    void append(const std::string& path, int results, long micros);
+    bool flush();
+    bool report(int days);
+
+private:
+    struct Entry
+    {
+        std::string path;
+        int results;
+        long micros;
+        time_t at;
+    };
+
+    sqlite3* db;
+    std::string log_file;
+    std::vector<Entry> pending;
+
+    bool openDatabase();
+    bool exec(const char* sql, const std::string& errMsg);
+};
+
+#endif // QUERYLOG_H
@@ -24,6 +24,7 @@ QT       -= gui
 TARGET = muttvcardsearch
 CONFIG   += console
 CONFIG   -= app_bundle
+CONFIG   += thread
 
 INCLUDEPATH +=
 
@@ -41,12 +42,26 @@ SOURCES += main.cpp \
     stringutils.cpp \
     fileutils.cpp \
     searchtemplates.cpp \
+    cardcompressor.cpp \
+    stats.cpp \
+    curlmetrics.cpp \
+    querylog.cpp \
+    curllib.cpp \
+    resultwriter.cpp \
+    searchsession.cpp \
+    aliasexporter.cpp \
+    fuzzymatcher.cpp \
+    parallelparser.cpp \
+    localsource.cpp \
+    vdirwatcher.cpp \
+    cacheimporter.cpp \
+    syncpipeline.cpp \
     vCard/vcard.cpp \
     vCard/vcardparam.cpp \
     vCard/vcardproperty.cpp \
     vCard/strutils.cpp
 
-LIBS += -lcurl -lsqlite3
+LIBS += -lcurl -lsqlite3 -lz
 
 HEADERS += \
     cardcurler.h \
@@ -59,6 +74,21 @@ HEADERS += \
     stringutils.h \
     fileutils.h \
     searchtemplates.h \
+    cardcompressor.h \
+    stats.h \
+    curlmetrics.h \
+    querylog.h \
+    curllib.h \
+    resultwriter.h \
+    searchsession.h \
+    aliasexporter.h \
+    fuzzymatcher.h \
+    parallelparser.h \
+    localsource.h \
+    vdirwatcher.h \
+    cacheimporter.h \
+    syncpipeline.h \
+    boundedqueue.h \
     vCard/vcard.h \
     vCard/vcard_globals.h \
     vCard/vcardparam.h \
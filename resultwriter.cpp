@@ -0,0 +1,70 @@
+#include "resultwriter.h"
+#include <ctype.h>
+#include <string.h>
+
+// huge results are written in chunks of this size
+#define RESULTWRITER_MAX_BUFFER (1024 * 1024)
+
+ResultWriter::ResultWriter(std::ostream &out, bool statusLine)
+    : out(out),
+      lines(0),
+      statusLine(statusLine)
+{
+}
+
+ResultWriter::~ResultWriter()
+{
+    flush();
+}
+
+std::string ResultWriter::normalize(const char *email) {
+    size_t begin = 0, end = strlen(email);
+    while(begin < end && isspace((unsigned char)email[begin])) begin++;
+    while(end > begin && isspace((unsigned char)email[end - 1])) end--;
+
+    std::string result(email + begin, end - begin);
+    for(size_t i=0; i<result.size(); i++)
+        result[i] = tolower((unsigned char)result[i]);
+    return result;
+}
+
+// false if the address was written already
+bool ResultWriter::add(const char *email, const char *firstName, const char *lastName) {
+    if(false == seen.insert(normalize(email)).second)
+        return false;
+
+    // mutt skips the first line, it is meant for a status message
+    if(lines == 0 && statusLine)
+        buffer += '\n';
+
+    buffer += email;
+    buffer += '\t';
+    buffer += firstName;
+    buffer += ' ';
+    buffer += lastName;
+    buffer += '\n';
+    lines++;
+
+    if(buffer.size() >= RESULTWRITER_MAX_BUFFER)
+        flush();
+
+    return true;
+}
+
+void ResultWriter::add(const Person &p) {
+    for(unsigned int i=0; i<p.Emails.size(); i++)
+        add(p.Emails.at(i).c_str(), p.FirstName.c_str(), p.LastName.c_str());
+}
+
+size_t ResultWriter::count() const {
+    return lines;
+}
+
+void ResultWriter::flush() {
+    if(buffer.size() == 0)
+        return;
+
+    out.write(buffer.data(), buffer.size());
+    out.flush();
+    buffer.clear();
+}
@@ -0,0 +1,35 @@
+#ifndef RESULTWRITER_H
+#define RESULTWRITER_H
+
+#include <iostream>
+#include <string>
+#include <unordered_set>
+#include "person.h"
+
+// Collects the lines mutt reads into one buffer and writes them with a
+// single write when done. An address already written, compared case
+// insensitive and without surrounding blanks, is skipped, so a contact
+// found in several sections or in the cache and online shows up once.
+class ResultWriter
+{
+public:
+    // statusLine: start with the empty line mutt skips
+    explicit ResultWriter(std::ostream& out = std::cout, bool statusLine = true);
+    ~ResultWriter();
+
+    bool add(const char* email, const char* firstName, const char* lastName);
+    void add(const Person& p);
+    size_t count() const;
+    void flush();
+
+private:
+    std::ostream& out;
+    std::string buffer;
+    std::unordered_set<std::string> seen;
+    size_t lines;
+    bool statusLine;
+
+    static std::string normalize(const char* email);
+};
+
+#endif // RESULTWRITER_H
@@ -0,0 +1,115 @@
+#include "searchsession.h"
+#include "searchtemplates.h"
+#include "fileutils.h"
+#include "stats.h"
+
+SearchSession::SearchSession(Settings *cfg, const std::vector<std::string> &sections, const std::vector<std::string> &selectedSections, int limit)
+{
+    this->cfg = cfg;
+    this->sections = sections;
+    this->selectedSections = selectedSections;
+    this->limit = limit;
+    fuzzy = true;
+
+    cache = NULL;
+    templateLoaded = false;
+
+    if(FileUtils::fileExists(Settings::getCacheFile()))
+        cache = new Cache();
+}
+
+SearchSession::~SearchSession()
+{
+    for(std::map<std::string, CardCurler*>::iterator it = curlers.begin(); it != curlers.end(); ++it)
+        delete it->second;
+
+    delete cache;
+}
+
+void SearchSession::setFuzzy(bool fuzzy) {
+    this->fuzzy = fuzzy;
+}
+
+CardCurler* SearchSession::curler(const std::string &section) {
+    std::map<std::string, CardCurler*>::iterator it = curlers.find(section);
+    if(it != curlers.end())
+        return it->second;
+
+    CardCurler* cc = new CardCurler(cfg->getProperty(section, "username"), cfg->getProperty(section, "password"), cfg->getProperty(section, "server"), "");
+    cc->setSection(section);
+    curlers[section] = cc;
+    return cc;
+}
+
+std::string SearchSession::search(const std::string &query, ResultWriter *writer) {
+    // 1. look into the cache, rows are written as sqlite returns them
+    if(cache) {
+        if(Option::isVerbose()) {
+            std::cout << "Cache lookup in file " << Settings::getCacheFile();
+        }
+
+        double phase = Stats::now();
+        int cacheRows = cache->writeFromCache(query, selectedSections, writer);
+        Stats::addTiming("main.cache_lookup", Stats::now() - phase);
+
+        if(Option::isVerbose()) {
+            std::cout << "Cache lookup returned " << cacheRows << " records";
+        }
+
+        if(cacheRows > 0)
+            return "cache_hit";
+
+        // a typo is far more likely than a contact the cache doesn't know
+        if(fuzzy) {
+            phase = Stats::now();
+            cacheRows = cache->writeFuzzyFromCache(query, selectedSections, limit, writer);
+            Stats::addTiming("main.fuzzy_lookup", Stats::now() - phase);
+
+            if(cacheRows > 0)
+                return "fuzzy_hit";
+        }
+    }
+
+    // 2. nothing found in cache? => search online
+    if(false == templateLoaded) {
+        if(false == SearchTemplates::load(false, &searchTemplate))
+            return "negative";
+        templateLoaded = true;
+    }
+
+    double phase = Stats::now();
+    std::string request = SearchTemplates::buildSearchQuery(searchTemplate, query, limit);
+    size_t written = writer->count();
+
+    std::vector<Person> people;
+    for(std::vector<std::string>::const_iterator it = sections.begin(); it != sections.end(); ++it) {
+        const std::string& section = *it;
+        if(cfg->getProperty(section, "server").size() == 0)
+            continue;
+
+        std::vector<Person> tmp_people = curler(section)->curlCard(request);
+        for(unsigned int i=0; i<tmp_people.size(); i++) {
+            tmp_people[i].section = section;
+            writer->add(tmp_people[i]);
+        }
+        people.insert(people.end(), tmp_people.begin(), tmp_people.end());
+    }
+
+    Stats::addTiming("main.online_search", Stats::now() - phase);
+
+    if(writer->count() == written)
+        return "negative";
+
+    // 3. the results go out before the cache is updated
+    writer->flush();
+
+    if(cache) {
+        StatsTimer timer("main.cache_writeback");
+        for(unsigned int i=0; i<people.size(); i++) {
+            const Person& p = people.at(i);
+            cache->addVCard(p.FirstName, p.LastName, p.Emails, p.rawCardData, p.lastUpdatedAt, p.section);
+        }
+    }
+
+    return "online";
+}
@@ -0,0 +1,47 @@
+#ifndef SEARCHSESSION_H
+#define SEARCHSESSION_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include "settings.h"
+#include "cache.h"
+#include "cardcurler.h"
+#include "resultwriter.h"
+
+// Answers searches: the cache first, the carddav servers of the configured
+// sections if the cache has nothing, and whatever was found online is
+// written back to the cache. A query the cache can't answer exactly gets
+// a second, typo tolerant chance in the cache before going online. The
+// cache with its prepared search statement and one curler, i.e. one
+// connection, per section stay open from one search to the next, which is
+// what --batch relies on.
+class SearchSession
+{
+public:
+    SearchSession(Settings* cfg, const std::vector<std::string>& sections, const std::vector<std::string>& selectedSections, int limit);
+    ~SearchSession();
+
+    // returns the path the search took: cache_hit, fuzzy_hit, online or negative
+    std::string search(const std::string& query, ResultWriter* writer);
+    void setFuzzy(bool fuzzy);
+
+private:
+    Settings* cfg;
+    std::vector<std::string> sections;
+    std::vector<std::string> selectedSections;
+    int limit;
+    bool fuzzy;
+
+    Cache* cache; // NULL without a cache file
+    bool templateLoaded;
+    std::string searchTemplate;
+    std::map<std::string, CardCurler*> curlers;
+
+    CardCurler* curler(const std::string& section);
+
+    SearchSession(const SearchSession&);
+    SearchSession& operator=(const SearchSession&);
+};
+
+#endif // SEARCHSESSION_H
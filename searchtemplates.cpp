@@ -1,4 +1,9 @@
 #include "searchtemplates.h"
+#include "stringutils.h"
+#include "fileutils.h"
+#include "settings.h"
+#include "stats.h"
+#include <sstream>
 
 SearchTemplates::SearchTemplates()
 {
@@ -13,10 +18,13 @@ SearchTemplates::SearchTemplates()
     searchTemplate += "<C:addressbook-query xmlns:D=\"DAV:\" xmlns:C=\"urn:ietf:params:xml:ns:carddav\">";
     searchTemplate += "<D:prop>";
     searchTemplate += "<D:getetag/>";
+    // only what CardCurler::createPerson looks at, no photos and the like
     searchTemplate += "<C:address-data>";
-    searchTemplate += "<C:prop name=\"EMAIL\"/>";
+    searchTemplate += "<C:prop name=\"N\"/>";
     searchTemplate += "<C:prop name=\"FN\"/>";
+    searchTemplate += "<C:prop name=\"EMAIL\"/>";
     searchTemplate += "<C:prop name=\"ITEM1.EMAIL\"/>";
+    searchTemplate += "<C:prop name=\"REV\"/>";
     searchTemplate += "</C:address-data>";
     searchTemplate += "</D:prop>";
     searchTemplate += "<C:filter test=\"anyof\">";
@@ -27,6 +35,7 @@ SearchTemplates::SearchTemplates()
     searchTemplate += "<C:text-match collation=\"i;unicode-casemap\" match-type=\"contains\">%s</C:text-match>";
     searchTemplate += "</C:prop-filter>";
     searchTemplate += "</C:filter>";
+    searchTemplate += "<C:limit><C:nresults>%n</C:nresults></C:limit>";
     searchTemplate += "</C:addressbook-query>";
 }
 
@@ -37,3 +46,48 @@ std::string SearchTemplates::getDefaultExportTemplate() const {
 std::string SearchTemplates::getDefaultSearchTemplate() const {
     return searchTemplate;
 }
+
+bool SearchTemplates::load(bool exportTemplate, std::string *query) {
+    StatsTimer timer("main.templates");
+    SearchTemplates st;
+    *query = exportTemplate ? st.getDefaultExportTemplate() : st.getDefaultSearchTemplate();
+
+    std::string templateFile = FileUtils::getHomeDir() + "/" + Settings::getConfigDir() + (exportTemplate ? "/export.xml" : "/search.xml");
+    if(FileUtils::fileExists(templateFile))
+        return FileUtils::getFileContent(templateFile, query);
+
+    return true;
+}
+
+// A single pass over the template, so a search containing %s or %n stays as it is.
+// With limit <= 0 the limit element is dropped and the server returns all matches
+std::string SearchTemplates::buildSearchQuery(const std::string &searchTemplate, const std::string &search, int limit) {
+    std::string tmpl = searchTemplate;
+    if(limit <= 0) {
+        size_t begin = tmpl.find("<C:limit>");
+        size_t end = tmpl.find("</C:limit>");
+        if(begin != std::string::npos && end != std::string::npos && end > begin)
+            tmpl.erase(begin, end + std::string("</C:limit>").size() - begin);
+    }
+
+    std::stringstream n;
+    n << limit;
+
+    std::string escaped = StringUtils::xmlEscape(search);
+    std::string result;
+    result.reserve(tmpl.size() + 2 * escaped.size());
+
+    for(size_t i=0; i<tmpl.size(); i++) {
+        if(tmpl[i] == '%' && i + 1 < tmpl.size() && tmpl[i+1] == 's') {
+            result += escaped;
+            i++;
+        } else if(tmpl[i] == '%' && i + 1 < tmpl.size() && tmpl[i+1] == 'n') {
+            result += n.str();
+            i++;
+        } else {
+            result += tmpl[i];
+        }
+    }
+
+    return result;
+}
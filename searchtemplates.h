@@ -3,6 +3,9 @@
 
 #include <string>
 
+// number of cards the server is asked to return for a search, see --limit
+#define DEFAULT_SEARCH_LIMIT 50
+
 class SearchTemplates
 {
 public:
@@ -10,6 +13,12 @@ public:
     std::string getDefaultExportTemplate() const;
     std::string getDefaultSearchTemplate() const;
 
+    // the default template or the one the user put next to the config, export.xml or search.xml
+    static bool load(bool exportTemplate, std::string* query);
+
+    // fills in %s (the xml escaped search) and %n (the limit) of a search template
+    static std::string buildSearchQuery(const std::string& searchTemplate, const std::string& search, int limit);
+
 private:
     std::string exportTemplate;
     std::string searchTemplate;
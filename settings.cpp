@@ -31,7 +31,6 @@ Settings::Settings() {
     std::ifstream f (filename.c_str());
 
     if(f.is_open()) {
-        int numSettings = 0; // we have 3
         std::string section;
         bool enterSection = false; // only valid for the first section
         while(getline(f, line)) {
@@ -63,87 +62,111 @@ Settings::Settings() {
                         } else {
                             v = tokens.at(1);
                         }
-                        std::map< std::string, std::string > _map = cfg[section];
-                        _map.insert(std::pair<std::string, std::string>(tokens.at(0), v));
-                        cfg[section] = _map;
-                        numSettings++;
+                        cfg[section].insert(std::pair<std::string, std::string>(tokens.at(0), v));
                     }
                 }
             }
         }
         f.close();
 
-        if( numSettings > 0 && (numSettings % 3) == 0)
-            valid = true;
+        // a carddav section needs server, username and password, a local one its path
+        valid = cfg.size() > 0;
+        for (CfgMap::const_iterator it = cfg.begin(); it != cfg.end(); ++it) {
+            const std::map<std::string, std::string>& m = it->second;
+            bool local = m.count("path") > 0;
+            bool remote = m.count("server") > 0 && m.count("username") > 0 && m.count("password") > 0;
+            if(false == local && false == remote)
+                valid = false;
+        }
     }
 }
 
 Settings::~Settings() {
-    if(changed) {
-        std::ofstream o;
-        o.open(getConfigFile().c_str(), ios::out | ios::trunc);
-
-        if(o.is_open()) {
-            CfgMap::iterator end = cfg.end();
-            for (CfgMap::const_iterator it = cfg.begin(); it != end; ++it) {
-                std::string section(it->first);
-                if(section.size() != 0) {
-                    o << "[" << section << "]" << endl;
-
-                    std::map <std::string, std::string> m = it->second;
-                    for(std::map <std::string, std::string>::iterator _it = m.begin(); _it != m.end(); _it++) {
-                        o << _it->first << "=" << _it->second << endl;
-                    }
+    if(changed)
+        save();
+}
 
-                    o << endl;
-                }
-            }
+// writes the config file, unchanged settings are not written at all
+bool Settings::save() {
+    if(false == changed)
+        return true;
 
-            o.close();
+    std::ofstream o;
+    o.open(getConfigFile().c_str(), ios::out | ios::trunc);
 
-        } else {
-            cerr << "Can't update/write config file '" << getConfigFile() << "'" << endl;
+    if(false == o.is_open()) {
+        cerr << "Can't update/write config file '" << getConfigFile() << "'" << endl;
+        return false;
+    }
+
+    for (CfgMap::const_iterator it = cfg.begin(); it != cfg.end(); ++it) {
+        const std::string& section = it->first;
+        if(section.size() != 0) {
+            o << "[" << section << "]" << endl;
+
+            const std::map <std::string, std::string>& m = it->second;
+            for(std::map <std::string, std::string>::const_iterator _it = m.begin(); _it != m.end(); _it++) {
+                o << _it->first << "=" << _it->second << endl;
+            }
+
+            o << endl;
         }
     }
 
-    cfg.clear();
+    o.close();
+    changed = false;
+    return true;
 }
 
-bool Settings::isValid() {
+bool Settings::isValid() const {
     return valid;
 }
 
-std::vector<std::string> Settings::getSections() {
+// a section read from a vdir or .vcf file instead of a carddav server
+bool Settings::isLocal(const std::string &section) const {
+    return getProperty(section, "path").size() > 0;
+}
+
+std::vector<std::string> Settings::getSections() const {
     std::vector<std::string> result;
-    CfgMap::iterator end = cfg.end();
-    for (CfgMap::const_iterator it = cfg.begin(); it != end; ++it) {
+    for (CfgMap::const_iterator it = cfg.begin(); it != cfg.end(); ++it) {
         result.push_back(it->first);
     }
     return result;
 }
 
-void Settings::setSection(const string &section) {
-    std::map <std::string, std::string> m;
-    cfg[section] = m;
-}
+// (re)configuring a section starts it from scratch, keys not in properties are dropped.
+// Configuring it the way it is already leaves the file alone
+void Settings::setSection(const string &section, const std::map<std::string, std::string> &properties) {
+    CfgMap::const_iterator current = cfg.find(section);
+    if(current != cfg.end() && current->second == properties)
+        return;
 
-void Settings::setProperty(const std::string &section, std::string key, std::string &value) {
-    std::map <std::string, std::string> m = cfg[section];
-    m[key] = value;
-    cfg[section] = m;
+    cfg[section] = properties;
     changed = true;
 }
 
-std::string Settings::getProperty(const std::string& section, const string &key) {
-    std::string res;
+void Settings::setProperty(const std::string &section, const std::string& key, const std::string &value) {
+    std::string& current = cfg[section][key];
+    if(current != value) {
+        current = value;
+        changed = true;
+    }
+}
+
+// unknown sections and keys yield an empty string, without adding them to the map
+const std::string& Settings::getProperty(const std::string& section, const string &key) const {
+    static const std::string empty;
 
-    std::map <std::string, std::string> m(cfg[section]);
-    std::map <std::string, std::string>::const_iterator it = m.begin();
-    it = m.find(key);
-    if(it != m.end())
-        res = it->second;
+    CfgMap::const_iterator s = cfg.find(section);
+    if(s == cfg.end())
+        return empty;
 
-    return res;
+    std::map <std::string, std::string>::const_iterator it = s->second.find(key);
+    if(it == s->second.end())
+        return empty;
+
+    return it->second;
 }
 
 const std::string Settings::getConfigDir() {
@@ -162,3 +185,10 @@ const std::string Settings::getCacheFile() {
     s.append("/").append(CONFIG_DIR).append("/cache.sqlite3");
     return s;
 }
+
+// kept apart from the cache so a rebuild doesn't throw the history away
+const std::string Settings::getStatsFile() {
+    std::string s = FileUtils::getHomeDir();
+    s.append("/").append(CONFIG_DIR).append("/stats.sqlite3");
+    return s;
+}
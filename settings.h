@@ -30,19 +30,24 @@
 #define CONFIG_FILE "muttvcardsearch.conf"
 typedef std::map <std::string, std::map <std::string, std::string> > CfgMap;
 
+// The parsed config file. main() owns the only instance and hands it to
+// whoever needs it, the file is written back only if something changed.
 class Settings
 {
 public:
     Settings();
     ~Settings();
-    void setSection(const std::string& section);
-    void setProperty(const std::string& section, std::string key, std::string& value);
-    std::string getProperty(const std::string& section, const std::string &key);
-    std::vector<std::string> getSections();
-    const std::string getCacheFile();
-    const std::string getConfigDir();
-    const std::string getConfigFile();
-    bool isValid();
+    void setSection(const std::string& section, const std::map<std::string, std::string>& properties);
+    void setProperty(const std::string& section, const std::string& key, const std::string& value);
+    const std::string& getProperty(const std::string& section, const std::string &key) const;
+    std::vector<std::string> getSections() const;
+    bool save();
+    static const std::string getCacheFile();
+    static const std::string getStatsFile();
+    static const std::string getConfigDir();
+    static const std::string getConfigFile();
+    bool isValid() const;
+    bool isLocal(const std::string& section) const;
 
 private:
     CfgMap cfg;
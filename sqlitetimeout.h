@@ -0,0 +1,7 @@
+#ifndef SQLITETIMEOUT_H
+#define SQLITETIMEOUT_H
+
+// how long the cache and the query log wait for a lock held by a concurrent instance
+#define SQLITE_BUSY_TIMEOUT_MS 2000
+
+#endif // SQLITETIMEOUT_H
@@ -0,0 +1,194 @@
+#include "stats.h"
+#include <iostream>
+#include <iomanip>
+#include <sstream>
+#include <map>
+#include <vector>
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <new>
+#include <stdlib.h>
+#include <sys/resource.h>
+
+// Replacing operator new affects every allocation of the program, so it is
+// only built with -DCOUNT_ALLOCATIONS=ON. Allocations are then counted with
+// --stats only, one shared counter written by every parser thread would cost
+// more than the parsing it measures
+#ifdef COUNT_ALLOCATIONS
+static std::atomic<bool> countAllocations(false);
+static std::atomic<long> numAllocations(0);
+
+void* operator new(size_t size) {
+    if(countAllocations.load(std::memory_order_relaxed))
+        numAllocations.fetch_add(1, std::memory_order_relaxed);
+    void* p = malloc(size ? size : 1);
+    if(p == NULL)
+        throw std::bad_alloc();
+    return p;
+}
+
+void* operator new[](size_t size) {
+    return operator new(size);
+}
+
+void operator delete(void* p) noexcept {
+    free(p);
+}
+
+void operator delete[](void* p) noexcept {
+    free(p);
+}
+#endif
+
+namespace {
+
+struct Timing
+{
+    long calls;
+    double seconds;
+};
+
+struct StatsData
+{
+    bool enabled;
+    bool json;
+    double start;
+    std::mutex mutex;
+    std::vector<std::string> order; // phases in the order they were first seen
+    std::map<std::string, Timing> timings;
+    std::map<std::string, long> counters;
+    std::map<std::string, std::string> values;
+};
+
+StatsData& data() {
+    static StatsData d;
+    return d;
+}
+
+// run time is measured from program start
+const double programStart = Stats::now();
+
+std::string jsonEscape(const std::string& text) {
+    std::string result;
+    for(unsigned int i=0; i<text.size(); i++) {
+        if(text[i] == '"' || text[i] == '\\')
+            result += '\\';
+        result += text[i];
+    }
+    return result;
+}
+
+}
+
+void Stats::enable(bool json) {
+    StatsData& d = data();
+    d.enabled = true;
+    d.json = json;
+#ifdef COUNT_ALLOCATIONS
+    countAllocations = true;
+#endif
+    atexit(&Stats::report);
+}
+
+bool Stats::isEnabled() {
+    return data().enabled;
+}
+
+double Stats::now() {
+    return std::chrono::duration<double>(std::chrono::steady_clock::now().time_since_epoch()).count();
+}
+
+void Stats::addTiming(const std::string &phase, double seconds) {
+    StatsData& d = data();
+    if(false == d.enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(d.mutex);
+    std::map<std::string, Timing>::iterator it = d.timings.find(phase);
+    if(it == d.timings.end()) {
+        Timing t = { 0, 0 };
+        it = d.timings.insert(std::make_pair(phase, t)).first;
+        d.order.push_back(phase);
+    }
+    it->second.calls++;
+    it->second.seconds += seconds;
+}
+
+void Stats::count(const std::string &counter, long n) {
+    StatsData& d = data();
+    if(false == d.enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.counters[counter] += n;
+}
+
+void Stats::setValue(const std::string &key, const std::string &value) {
+    StatsData& d = data();
+    if(false == d.enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(d.mutex);
+    d.values[key] = value;
+}
+
+void Stats::report() {
+    StatsData& d = data();
+    if(false == d.enabled)
+        return;
+
+    std::lock_guard<std::mutex> lock(d.mutex);
+    double total = now() - programStart;
+#ifdef COUNT_ALLOCATIONS
+    d.counters["allocations"] = numAllocations.load();
+#endif
+
+    // the high water mark, to check a sync stays within --max-memory
+    struct rusage usage;
+    if(getrusage(RUSAGE_SELF, &usage) == 0)
+        d.counters["peak_rss_kb"] = usage.ru_maxrss;
+
+    std::stringstream ss;
+    if(d.json) {
+        ss << std::fixed << std::setprecision(3);
+        ss << "{\"total_ms\":" << total * 1000 << ",\"timings\":{";
+        for(unsigned int i=0; i<d.order.size(); i++) {
+            const Timing& t = d.timings[d.order.at(i)];
+            ss << (i ? "," : "") << "\"" << jsonEscape(d.order.at(i)) << "\":{\"calls\":" << t.calls << ",\"ms\":" << t.seconds * 1000 << "}";
+        }
+        ss << "},\"counters\":{";
+        for(std::map<std::string, long>::const_iterator it = d.counters.begin(); it != d.counters.end(); ++it)
+            ss << (it == d.counters.begin() ? "" : ",") << "\"" << jsonEscape(it->first) << "\":" << it->second;
+        ss << "},\"values\":{";
+        for(std::map<std::string, std::string>::const_iterator it = d.values.begin(); it != d.values.end(); ++it)
+            ss << (it == d.values.begin() ? "" : ",") << "\"" << jsonEscape(it->first) << "\":\"" << jsonEscape(it->second) << "\"";
+        ss << "}}" << std::endl;
+    } else {
+        ss << "---- stats ----" << std::endl;
+        ss << std::left << std::setw(32) << "phase" << std::right << std::setw(8) << "calls" << std::setw(12) << "ms" << std::endl;
+        ss << std::fixed << std::setprecision(3);
+        for(unsigned int i=0; i<d.order.size(); i++) {
+            const Timing& t = d.timings[d.order.at(i)];
+            ss << std::left << std::setw(32) << d.order.at(i) << std::right << std::setw(8) << t.calls << std::setw(12) << t.seconds * 1000 << std::endl;
+        }
+        ss << std::left << std::setw(32) << "total" << std::right << std::setw(8) << 1 << std::setw(12) << total * 1000 << std::endl;
+        for(std::map<std::string, long>::const_iterator it = d.counters.begin(); it != d.counters.end(); ++it)
+            ss << std::left << std::setw(32) << it->first << std::right << std::setw(20) << it->second << std::endl;
+        for(std::map<std::string, std::string>::const_iterator it = d.values.begin(); it != d.values.end(); ++it)
+            ss << std::left << std::setw(32) << it->first << std::right << std::setw(20) << it->second << std::endl;
+    }
+
+    std::cerr << ss.str();
+}
+
+StatsTimer::StatsTimer(const char *phase)
+    : phase(phase),
+      start(Stats::isEnabled() ? Stats::now() : 0)
+{
+}
+
+StatsTimer::~StatsTimer() {
+    if(Stats::isEnabled())
+        Stats::addTiming(phase, Stats::now() - start);
+}
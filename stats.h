@@ -0,0 +1,34 @@
+#ifndef STATS_H
+#define STATS_H
+
+#include <string>
+
+// Collects per phase timings and counters of a single run. Enabled with
+// --stats or --stats=json, the report is written to stderr when the
+// program exits so the output mutt reads stays untouched.
+class Stats
+{
+public:
+    static void enable(bool json);
+    static bool isEnabled();
+
+    static double now(); // monotonic, in seconds
+    static void addTiming(const std::string& phase, double seconds);
+    static void count(const std::string& counter, long n = 1);
+    static void setValue(const std::string& key, const std::string& value);
+    static void report();
+};
+
+// adds the time between construction and destruction to a phase
+class StatsTimer
+{
+public:
+    StatsTimer(const char* phase);
+    ~StatsTimer();
+
+private:
+    const char* phase;
+    double start;
+};
+
+#endif // STATS_H
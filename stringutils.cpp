@@ -106,3 +106,20 @@ void StringUtils::replace(string *text, const string &from, const string &to) {
         pos = text->find(from);
     }
 }
+
+// escapes text for use as xml character data or attribute value
+string StringUtils::xmlEscape(const string &text) {
+    string result;
+    result.reserve(text.size());
+    for(unsigned int i=0; i<text.size(); i++) {
+        switch(text[i]) {
+        case '&':  result += "&amp;"; break;
+        case '<':  result += "&lt;"; break;
+        case '>':  result += "&gt;"; break;
+        case '"':  result += "&quot;"; break;
+        case '\'': result += "&apos;"; break;
+        default:   result += text[i]; break;
+        }
+    }
+    return result;
+}
@@ -36,6 +36,7 @@ public:
     static bool startsWith(const string& text, const string prefix);
     static bool contains(const string& text, const string& pattern);
     static void replace(string *text, const std::string& from, const std::string& to);
+    static string xmlEscape(const string& text);
 };
 
 #endif // STRINGUTILS_H
@@ -0,0 +1,273 @@
+#include "syncpipeline.h"
+#include "boundedqueue.h"
+#include "parallelparser.h"
+#include "option.h"
+#include "stats.h"
+#include <thread>
+#include <map>
+#include <sstream>
+#include <iomanip>
+
+SyncPipeline::Stage::Stage()
+    : threads(0),
+      busy(0),
+      items(0),
+      depthSum(0),
+      depthSamples(0),
+      depthMax(0),
+      capacity(0)
+{
+}
+
+void SyncPipeline::Stage::add(const Stage &other) {
+    busy += other.busy;
+    items += other.items;
+    depthSum += other.depthSum;
+    depthSamples += other.depthSamples;
+    if(other.depthMax > depthMax)
+        depthMax = other.depthMax;
+}
+
+SyncPipeline::SyncPipeline(CardSink *sink, size_t maxBytes)
+    : sink(sink),
+      maxBytes(maxBytes),
+      numCards(0),
+      numParsed(0),
+      elapsed(0),
+      bytesInFlight(0),
+      stop(false),
+      interrupted(false)
+{
+}
+
+bool SyncPipeline::run(size_t items, unsigned int connections, CardFetcher *fetcher) {
+    double start = Stats::now();
+
+    if(connections < 1)
+        connections = 1;
+    unsigned int parsers = ParallelParser::cores();
+
+    BoundedQueue<Body*> bodies(SYNC_QUEUE_SIZE);
+    BoundedQueue<Parsed*> parsed(SYNC_QUEUE_SIZE);
+    std::atomic<size_t> next(0);
+    std::atomic<unsigned int> downloading(connections);
+    std::atomic<unsigned int> parsing(parsers);
+
+    download.threads = connections;
+    download.capacity = bodies.capacity();
+    parse.threads = parsers;
+    parse.capacity = parsed.capacity();
+    write.threads = 1;
+
+    std::vector<std::thread> pool;
+    for(unsigned int c=0; c<connections; c++) {
+        pool.push_back(std::thread([&, c]() {
+            Stage local;
+            for(;;) {
+                // back-pressure: wait for the writer before taking the next item,
+                // an item once taken always reaches the writer
+                unsigned int spins = 0;
+                while(maxBytes > 0 && bytesInFlight.load() >= maxBytes && false == stop.load())
+                    BoundedQueue<Body*>::pause(&spins);
+
+                if(stop.load())
+                    break;
+
+                size_t index = next.fetch_add(1);
+                if(index >= items)
+                    break;
+
+                Body* body = new Body;
+                body->index = index;
+
+                double t = Stats::now();
+                if(false == fetcher->fetch(c, index, &body->card)) {
+                    body->card.body.clear();
+                    interrupted.store(true);
+                    stop.store(true);
+                }
+                local.busy += Stats::now() - t;
+                local.items++;
+
+                bytesInFlight += body->card.body.size();
+                bodies.push(body);
+
+                size_t depth = bodies.size();
+                local.depthSum += depth;
+                local.depthSamples++;
+                if(depth > local.depthMax)
+                    local.depthMax = depth;
+            }
+
+            std::lock_guard<std::mutex> lock(statsMutex);
+            download.add(local);
+            if(--downloading == 0)
+                bodies.close();
+        }));
+    }
+
+    for(unsigned int p=0; p<parsers; p++) {
+        pool.push_back(std::thread([&]() {
+            Stage local;
+            Body* body;
+            while(bodies.pop(&body)) {
+                double t = Stats::now();
+                Parsed* result = new Parsed;
+                result->index = body->index;
+                result->bytes = body->card.body.size();
+                result->notModified = body->card.notModified;
+
+                std::vector<std::string> chunks;
+                ParallelParser::splitCards(body->card.body.data(), body->card.body.size(), &chunks);
+
+                for(unsigned int i=0; i<chunks.size(); i++)
+                    ParallelParser::parseChunk(chunks.at(i), NULL, &result->people);
+
+                for(unsigned int i=0; i<result->people.size(); i++) {
+                    result->people[i].href = fetcher->href(result->index);
+                    result->people[i].validators = body->card.validators;
+                }
+                delete body;
+
+                local.busy += Stats::now() - t;
+                local.items++;
+
+                parsed.push(result);
+
+                size_t depth = parsed.size();
+                local.depthSum += depth;
+                local.depthSamples++;
+                if(depth > local.depthMax)
+                    local.depthMax = depth;
+            }
+
+            std::lock_guard<std::mutex> lock(statsMutex);
+            parse.add(local);
+            if(--parsing == 0)
+                parsed.close();
+        }));
+    }
+
+    // the writer: puts the items back in order and passes them on in batches.
+    // After a sink failure it keeps draining, so the other stages can finish
+    bool ok = true;
+    std::map<size_t, Parsed*> waiting;
+    size_t expected = 0;
+    std::vector<Person> batch;
+    std::vector<std::string> kept;
+    size_t batchBytes = 0;
+
+    Parsed* result;
+    while(parsed.pop(&result)) {
+        double t = Stats::now();
+        waiting[result->index] = result;
+
+        while(waiting.size() > 0 && waiting.begin()->first == expected) {
+            Parsed* ready = waiting.begin()->second;
+            if(ready->notModified)
+                kept.push_back(fetcher->href(ready->index));
+            numParsed += ready->people.size();
+            batch.insert(batch.end(), std::make_move_iterator(ready->people.begin()), std::make_move_iterator(ready->people.end()));
+            batchBytes += ready->bytes;
+            delete ready;
+            waiting.erase(waiting.begin());
+            expected++;
+        }
+
+        if(batch.size() + kept.size() >= SYNC_BATCH_CARDS || (maxBytes > 0 && batchBytes >= maxBytes / 2))
+            ok = flush(&batch, &kept, &batchBytes, ok);
+
+        write.busy += Stats::now() - t;
+        write.items++;
+    }
+
+    for(unsigned int i=0; i<pool.size(); i++)
+        pool[i].join();
+
+    // items behind a failed download
+    for(std::map<size_t, Parsed*>::iterator it = waiting.begin(); it != waiting.end(); ++it) {
+        if(it->second->notModified)
+            kept.push_back(fetcher->href(it->first));
+        numParsed += it->second->people.size();
+        batch.insert(batch.end(), std::make_move_iterator(it->second->people.begin()), std::make_move_iterator(it->second->people.end()));
+        batchBytes += it->second->bytes;
+        delete it->second;
+    }
+
+    double t = Stats::now();
+    ok = flush(&batch, &kept, &batchBytes, ok);
+    write.busy += Stats::now() - t;
+
+    elapsed = Stats::now() - start;
+    return ok && false == interrupted.load();
+}
+
+// hands the batch to the sink, once the sink failed the cards are only dropped
+bool SyncPipeline::flush(std::vector<Person> *batch, std::vector<std::string> *kept, size_t *batchBytes, bool ok) {
+    if(kept->size() > 0 && ok) {
+        Stats::count("sync_not_modified", kept->size());
+        int copied = sink->keepCards(*kept);
+        ok = copied >= 0;
+        if(ok)
+            numCards += copied;
+    }
+
+    if(batch->size() > 0 && ok) {
+        Stats::count("sync_batches");
+        numCards += batch->size();
+        ok = sink->addCards(*batch);
+    }
+
+    if(false == ok)
+        stop.store(true);
+
+    std::vector<Person>().swap(*batch);
+    kept->clear();
+    bytesInFlight -= *batchBytes;
+    *batchBytes = 0;
+    return ok;
+}
+
+long SyncPipeline::cards() const {
+    return numCards;
+}
+
+double SyncPipeline::seconds() const {
+    return elapsed;
+}
+
+std::string SyncPipeline::describe(const Stage &stage, double elapsed) {
+    std::stringstream ss;
+    ss << std::fixed << std::setprecision(0);
+
+    double busy = elapsed > 0 ? stage.busy / (elapsed * stage.threads) * 100 : 0;
+    ss << stage.threads << (stage.threads == 1 ? " thread, " : " threads, ") << busy << "% busy, " << stage.items << " items";
+
+    if(stage.capacity > 0) {
+        double depth = stage.depthSamples > 0 ? (double)stage.depthSum / stage.depthSamples : 0;
+        ss << ", queue " << std::setprecision(1) << depth << " avg " << stage.depthMax << " max of " << stage.capacity;
+    }
+
+    return ss.str();
+}
+
+void SyncPipeline::report(const std::string &section) const {
+    std::string download = describe(this->download, elapsed);
+    std::string parse = describe(this->parse, elapsed);
+    std::string write = describe(this->write, elapsed);
+
+    // the stage closest to 100% busy is the one holding up the others
+    Stats::setValue("sync." + section + ".download", download);
+    Stats::setValue("sync." + section + ".parse", parse);
+    Stats::setValue("sync." + section + ".write", write);
+
+    // the parser threads keep their own totals, they are added up once here
+    Stats::addTiming("SyncPipeline::parse", this->parse.busy);
+    Stats::count("cards_parsed", numParsed);
+
+    if(Option::isVerbose()) {
+        std::cout << "Sync pipeline [" << section << "] download: " << download << std::endl;
+        std::cout << "Sync pipeline [" << section << "] parse:    " << parse << std::endl;
+        std::cout << "Sync pipeline [" << section << "] write:    " << write << std::endl;
+    }
+}
@@ -0,0 +1,117 @@
+#ifndef SYNCPIPELINE_H
+#define SYNCPIPELINE_H
+
+#include <string>
+#include <vector>
+#include <atomic>
+#include <mutex>
+#include "person.h"
+#include "cardcurler.h"
+
+// connections a sync opens to one server
+#define SYNC_CONNECTIONS 4
+
+// a failed download is tried again this often, waiting twice as long each time
+#define SYNC_RETRIES 4
+#define SYNC_RETRY_DELAY_MS 500
+
+// slots of each queue between two stages
+#define SYNC_QUEUE_SIZE 64
+
+// an item of a sync as the server sent it
+struct FetchedCard
+{
+    std::string body;
+    CardValidators validators;
+    bool notModified;   // the card is the one of the previous cache, body is empty
+
+    FetchedCard() : notModified(false) {}
+};
+
+// Downloads the items of a sync, see SyncPipeline
+class CardFetcher
+{
+public:
+    virtual ~CardFetcher() {}
+
+    // downloads item index using one of the connections. FALSE stops the sync
+    virtual bool fetch(unsigned int connection, size_t index, FetchedCard* card) = 0;
+
+    // the href of item index, the cards of the item remember it
+    virtual const std::string& href(size_t index) const = 0;
+};
+
+// Runs a sync as three stages joined by bounded lock-free queues, so
+// network, parsing and sqlite work at the same time: download workers,
+// one per connection, fetch the items, parser workers, one per core, turn
+// them into Persons and the calling thread, the only one that touches the
+// cache, hands them to the sink in large batches and in the order of the
+// items. Items the server reports as not modified skip the parser and are
+// passed to the sink by href only. Downloads wait while maxBytes of vcard text are on their way
+// through the stages, 0 lifts that limit.
+class SyncPipeline
+{
+public:
+    SyncPipeline(CardSink* sink, size_t maxBytes);
+
+    // FALSE if the sink failed or a download failed for good, which ends
+    // the sync early. The cards downloaded before reach the sink either way
+    bool run(size_t items, unsigned int connections, CardFetcher* fetcher);
+
+    long cards() const;
+
+    // wall time of the last run in seconds
+    double seconds() const;
+
+    // depth of the queues and busy share of the stages, to --stats and with -v to stdout
+    void report(const std::string& section) const;
+
+private:
+    struct Body
+    {
+        size_t index;
+        FetchedCard card;
+    };
+
+    struct Parsed
+    {
+        size_t index;
+        size_t bytes;
+        bool notModified;
+        std::vector<Person> people;
+    };
+
+    struct Stage
+    {
+        unsigned int threads;
+        double busy;            // seconds of all threads together
+        long items;
+        long depthSum;          // depth of the queue the stage feeds, sampled on each push
+        long depthSamples;
+        size_t depthMax;
+        size_t capacity;
+
+        Stage();
+        void add(const Stage& other);
+    };
+
+    CardSink* sink;
+    size_t maxBytes;
+    long numCards;
+    long numParsed;
+    double elapsed;
+
+    std::atomic<size_t> bytesInFlight;
+    std::atomic<bool> stop;
+    std::atomic<bool> interrupted;
+
+    std::mutex statsMutex;
+    Stage download;
+    Stage parse;
+    Stage write;
+
+    bool flush(std::vector<Person>* batch, std::vector<std::string>* kept, size_t* batchBytes, bool ok);
+    static std::string describe(const Stage& stage, double elapsed);
+};
+
+#endif // SYNCPIPELINE_H
@@ -0,0 +1,86 @@
+// Unit tests of the alias export, run by ctest.
+
+#include <iostream>
+#include <fstream>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <unistd.h>
+#include "aliasexporter.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; failures++; } } while(0)
+
+static Person person(const std::string& first, const std::string& last, const std::string& email) {
+    Person p;
+    p.FirstName = first;
+    p.LastName = last;
+    p.Emails.push_back(email);
+    return p;
+}
+
+static std::string readFile(const std::string& file) {
+    std::ifstream in(file.c_str());
+    std::stringstream ss;
+    ss << in.rdbuf();
+    return ss.str();
+}
+
+// names and addresses of a shared address book must not run commands or add rc lines when mutt sources the file
+static void testHostileCards(const std::string& dir) {
+    std::vector<Person> people;
+    people.push_back(person("x`rm -rf ~`", "Smith", "smith@example.com"));
+    people.push_back(person("$HOME", "Dollar", "dollar@example.com"));
+    people.push_back(person("Evil\nsource /tmp/x", "Newline", "newline@example.com"));
+    people.push_back(person("Back\\slash", "O'Hara #1", "hara@example.com"));
+    people.push_back(person("Tick", "Mail", "evil`id`@example.com"));
+    people.push_back(person("New", "Line", "a@example.com>\nsource /tmp/x"));
+    people.push_back(person("Dollar", "Mail", "$USER@example.com"));
+    people.push_back(person("Space", "Mail", "john doe@example.com"));
+
+    std::string file = dir + "/aliases";
+    CHECK(AliasExporter::exportAliases(people, file));
+
+    std::string expected =
+            "# generated by muttvcardsearch, changes will be overwritten\n"
+            "alias backslash.ohara.1 \"Back\\\\\\\\slash O'Hara \\#1\" <hara@example.com>\n"
+            "alias evil.source.tmpx.newline Evil source /tmp/x Newline <newline@example.com>\n"
+            "alias home.dollar \\$HOME Dollar <dollar@example.com>\n"
+            "alias xrm.rf.smith x\\`rm -rf ~\\` Smith <smith@example.com>\n";
+    CHECK(readFile(file) == expected);
+
+    std::string flat = dir + "/contacts.tsv";
+    CHECK(AliasExporter::exportFlat(people, flat));
+    CHECK(readFile(flat) ==
+          "dollar@example.com\t$HOME Dollar\n"
+          "hara@example.com\tBack\\slash O'Hara #1\n"
+          "newline@example.com\tEvil source /tmp/x Newline\n"
+          "smith@example.com\tx`rm -rf ~` Smith\n");
+
+    unlink(file.c_str());
+    unlink(flat.c_str());
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/muttvcardsearch_aliastest.XXXXXX";
+    char* dir = mkdtemp(tmpl);
+    if(dir == NULL) {
+        std::cerr << "Can't create a temporary directory" << std::endl;
+        return 1;
+    }
+
+    // the exporter reports what it wrote on stdout
+    std::streambuf* out = std::cout.rdbuf();
+    std::stringstream discard;
+    std::cout.rdbuf(discard.rdbuf());
+    testHostileCards(dir);
+    std::cout.rdbuf(out);
+
+    rmdir(dir);
+    if(failures > 0)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,70 @@
+// Unit tests of the cache, run by ctest.
+
+#include <iostream>
+#include <string>
+#include <vector>
+#include <stdlib.h>
+#include <unistd.h>
+#include "cache.h"
+
+static int failures = 0;
+
+#define CHECK(cond) \
+    do { if(!(cond)) { std::cerr << __FILE__ << ":" << __LINE__ << ": CHECK(" #cond ") failed" << std::endl; failures++; } } while(0)
+
+static std::string card(const std::string& first, const std::string& last) {
+    return "BEGIN:VCARD\r\nVERSION:3.0\r\nN:" + last + ";" + first + ";;;\r\nFN:" + first + " " + last
+            + "\r\nEMAIL:" + first + "." + last + "@example.com\r\nNOTE:met at the conference\r\nEND:VCARD\r\n";
+}
+
+// a compressed card comes back from a reopened cache as it was stored
+static void testCompressedRoundTrip(const std::string& dir) {
+    std::string file = dir + "/cache.sqlite3";
+    std::vector<std::string> samples;
+    for(int i=0; i<20; i++)
+        samples.push_back(card("First" + std::to_string(i), "Last" + std::to_string(i)));
+
+    {
+        Cache cache(file);
+        CHECK(cache.createDatabase());
+        CHECK(cache.setStorageOptions(true, false));
+        CHECK(cache.beginTransaction());
+        CHECK(cache.trainDictionary(samples));
+        for(unsigned int i=0; i<samples.size(); i++) {
+            std::vector<std::string> emails(1, "first" + std::to_string(i) + "@example.com");
+            cache.addVCard("First" + std::to_string(i), "Last" + std::to_string(i), emails, samples.at(i), "", "test");
+        }
+        CHECK(cache.commitTransaction());
+        CHECK(cache.commitDatabase());
+    }
+
+    Cache cache(file);
+    for(unsigned int i=0; i<samples.size(); i++) {
+        std::string data;
+        CHECK(cache.getVCardData(i + 1, &data));
+        CHECK(data == samples.at(i));
+    }
+
+    std::string missing;
+    CHECK(false == cache.getVCardData(samples.size() + 1, &missing));
+
+    unlink(file.c_str());
+    unlink((file + ".tmp.lock").c_str());
+}
+
+int main()
+{
+    char tmpl[] = "/tmp/muttvcardsearch_cachetest.XXXXXX";
+    char* dir = mkdtemp(tmpl);
+    if(dir == NULL) {
+        std::cerr << "Can't create a temporary directory" << std::endl;
+        return 1;
+    }
+
+    testCompressedRoundTrip(dir);
+
+    rmdir(dir);
+    if(failures > 0)
+        std::cerr << failures << " checks failed" << std::endl;
+    return failures > 0 ? 1 : 0;
+}
@@ -0,0 +1,163 @@
+#include "vdirwatcher.h"
+#include "stats.h"
+#include "option.h"
+#include <iostream>
+#include <sys/inotify.h>
+#include <poll.h>
+#include <signal.h>
+#include <unistd.h>
+#include <string.h>
+#include <errno.h>
+#include <limits.h>
+
+// close and rename cover editors and sync tools, which write a temporary file and move it in place
+#define WATCH_EVENTS (IN_CLOSE_WRITE | IN_MOVED_TO | IN_MOVED_FROM | IN_DELETE | IN_CREATE | IN_DELETE_SELF | IN_MOVE_SELF)
+
+static volatile sig_atomic_t stopRequested = 0;
+
+static void requestStop(int) {
+    stopRequested = 1;
+}
+
+VdirWatcher::VdirWatcher()
+{
+    fd = inotify_init1(IN_CLOEXEC | IN_NONBLOCK);
+    if(fd < 0)
+        std::cerr << "Can't watch for file changes: " << strerror(errno) << std::endl;
+
+    // no SA_RESTART, poll() has to return to notice the request
+    struct sigaction sa;
+    memset(&sa, 0, sizeof(sa));
+    sa.sa_handler = &requestStop;
+    sigaction(SIGINT, &sa, NULL);
+    sigaction(SIGTERM, &sa, NULL);
+}
+
+VdirWatcher::~VdirWatcher()
+{
+    if(fd >= 0)
+        close(fd);
+}
+
+bool VdirWatcher::watchDir(LocalSource *source, const std::string &dir) {
+    int wd = inotify_add_watch(fd, dir.c_str(), WATCH_EVENTS);
+    if(wd < 0) {
+        std::cerr << "Can't watch '" << dir << "': " << strerror(errno) << std::endl;
+        return false;
+    }
+
+    Watch w;
+    w.source = source;
+    w.dir = dir;
+    watches[wd] = w;
+
+    if(Option::isVerbose())
+        std::cout << "Watching " << dir << std::endl;
+    return true;
+}
+
+bool VdirWatcher::add(LocalSource *source) {
+    if(fd < 0)
+        return false;
+
+    std::vector<std::string> dirs = source->watchDirs();
+    for(unsigned int i=0; i<dirs.size(); i++) {
+        if(false == watchDir(source, dirs.at(i)))
+            return false;
+    }
+    return true;
+}
+
+// adds the pending events to burst, returns true if there were any
+bool VdirWatcher::readEvents(WatchBurst *burst) {
+    char buffer[64 * (sizeof(struct inotify_event) + NAME_MAX + 1)] __attribute__((aligned(__alignof__(struct inotify_event))));
+    bool any = false;
+
+    while(true) {
+        ssize_t len = read(fd, buffer, sizeof(buffer));
+        if(len <= 0)
+            break;
+
+        for(char* p = buffer; p < buffer + len; ) {
+            const struct inotify_event* event = reinterpret_cast<const struct inotify_event*>(p);
+            p += sizeof(struct inotify_event) + event->len;
+            any = true;
+
+            // the kernel dropped events, every section has to be compared
+            if(event->mask & IN_Q_OVERFLOW) {
+                for(std::map<int, Watch>::const_iterator it = watches.begin(); it != watches.end(); ++it)
+                    burst->rescan.insert(it->second.source);
+                continue;
+            }
+
+            std::map<int, Watch>::iterator it = watches.find(event->wd);
+            if(it == watches.end())
+                continue;
+
+            LocalSource* source = it->second.source;
+            if(event->mask & IN_IGNORED) {
+                // the directory itself is gone
+                watches.erase(it);
+                burst->rescan.insert(source);
+                continue;
+            }
+
+            if(event->len == 0)
+                continue;
+
+            std::string path = it->second.dir + "/" + event->name;
+            if(event->mask & IN_ISDIR) {
+                // a new collection, vdirsyncer creates one directory per address book
+                if((event->mask & (IN_CREATE | IN_MOVED_TO)) && it->second.dir == source->path())
+                    watchDir(source, path);
+                burst->rescan.insert(source);
+            } else if(source->contains(path)) {
+                burst->paths[source].insert(path);
+            }
+        }
+    }
+
+    return any;
+}
+
+bool VdirWatcher::wait(WatchBurst *burst) {
+    if(fd < 0)
+        return false;
+
+    burst->paths.clear();
+    burst->rescan.clear();
+
+    struct pollfd pfd;
+    pfd.fd = fd;
+    pfd.events = POLLIN;
+
+    double first = 0;
+    while(false == stopRequested) {
+        bool pending = burst->paths.size() > 0 || burst->rescan.size() > 0;
+        int timeout = -1;
+        if(pending) {
+            int left = WATCH_MAX_DELAY_MS - (int)((Stats::now() - first) * 1000);
+            if(left <= 0)
+                return true;
+            timeout = left < WATCH_DEBOUNCE_MS ? left : WATCH_DEBOUNCE_MS;
+        }
+
+        int rc = poll(&pfd, 1, timeout);
+        if(rc < 0) {
+            if(errno == EINTR)
+                continue;
+            std::cerr << "Watching for file changes failed: " << strerror(errno) << std::endl;
+            return false;
+        }
+
+        // quiet for WATCH_DEBOUNCE_MS, the burst is over
+        if(rc == 0)
+            return true;
+
+        readEvents(burst);
+        if(false == pending && (burst->paths.size() > 0 || burst->rescan.size() > 0))
+            first = Stats::now();
+    }
+
+    return false;
+}
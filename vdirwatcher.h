@@ -0,0 +1,55 @@
+#ifndef VDIRWATCHER_H
+#define VDIRWATCHER_H
+
+#include <string>
+#include <vector>
+#include <map>
+#include <set>
+#include "localsource.h"
+
+// how long the directories have to stay quiet before a burst of changes is applied
+#define WATCH_DEBOUNCE_MS 200
+
+// a burst that never calms down is applied after this long anyway
+#define WATCH_MAX_DELAY_MS 1000
+
+// The files of local sections that changed together, i.e. during one run
+// of the sync tool. A section in rescan lost events or got a new
+// collection directory and has to be compared file by file.
+struct WatchBurst
+{
+    std::map<LocalSource*, std::set<std::string> > paths;
+    std::set<LocalSource*> rescan;
+};
+
+// Waits for changes to the directories of local sections with inotify and
+// hands them out in bursts. Between bursts the process sleeps in poll().
+class VdirWatcher
+{
+public:
+    VdirWatcher();
+    ~VdirWatcher();
+
+    bool add(LocalSource* source);
+
+    // blocks until the next burst, false once interrupted by SIGINT or SIGTERM
+    bool wait(WatchBurst* burst);
+
+private:
+    struct Watch
+    {
+        LocalSource* source;
+        std::string dir;
+    };
+
+    int fd;
+    std::map<int, Watch> watches;
+
+    bool watchDir(LocalSource* source, const std::string& dir);
+    bool readEvents(WatchBurst* burst);
+
+    VdirWatcher(const VdirWatcher&);
+    VdirWatcher& operator=(const VdirWatcher&);
+};
+
+#endif // VDIRWATCHER_H